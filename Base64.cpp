@@ -0,0 +1,291 @@
+#include "Base64.h"
+
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define BASE64_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace {
+
+const char encode_table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+const uint8_t INVALID = 0xFF;
+
+struct DecodeTable
+{
+    uint8_t value[256];
+
+    DecodeTable()
+    {
+        memset(value, INVALID, sizeof(value));
+        for (uint8_t i=0; i<64; ++i) value[uint8_t(encode_table[i])] = i;
+    }
+};
+const DecodeTable decode_table;
+
+// Every kernel handles a prefix of the input and returns how much of it it took,
+// the scalar code finishes the rest (and the padding).
+using EncodeKernel = size_t (*)(const uint8_t *in, size_t n, char *out);
+using DecodeKernel = size_t (*)(const char *in, size_t n, uint8_t *out);
+
+size_t encode_scalar(const uint8_t *in, size_t n, char *out)
+{
+    size_t i = 0;
+    for (; i + 3 <= n; i += 3)
+    {
+        uint32_t x = (uint32_t(in[i]) << 16) | (uint32_t(in[i+1]) << 8) | in[i+2];
+        *out++ = encode_table[(x >> 18) & 0x3f];
+        *out++ = encode_table[(x >> 12) & 0x3f];
+        *out++ = encode_table[(x >> 6) & 0x3f];
+        *out++ = encode_table[x & 0x3f];
+    }
+    return i;
+}
+
+size_t decode_scalar(const char *in, size_t n, uint8_t *out)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        uint8_t a = decode_table.value[uint8_t(in[i])];
+        uint8_t b = decode_table.value[uint8_t(in[i+1])];
+        uint8_t c = decode_table.value[uint8_t(in[i+2])];
+        uint8_t d = decode_table.value[uint8_t(in[i+3])];
+        if ((a | b | c | d) == INVALID) break;
+
+        uint32_t x = (uint32_t(a) << 18) | (uint32_t(b) << 12) | (uint32_t(c) << 6) | d;
+        *out++ = uint8_t(x >> 16);
+        *out++ = uint8_t(x >> 8);
+        *out++ = uint8_t(x);
+    }
+    return i;
+}
+
+#ifdef BASE64_X86_KERNELS
+
+// 12 bytes (in the low lanes after the shuffle) to 16 6-bit indices, one per byte
+__attribute__((target("ssse3")))
+inline __m128i split_indices_ssse3(__m128i in)
+{
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+// index to character: 'A' + i, then 'a' - 26 + i, '0' - 52 + i, '+' and '/'
+__attribute__((target("ssse3")))
+inline __m128i indices_to_chars_ssse3(__m128i idx)
+{
+    __m128i shift = _mm_set1_epi8('A');
+    shift = _mm_add_epi8(shift, _mm_and_si128(_mm_cmpgt_epi8(idx, _mm_set1_epi8(25)), _mm_set1_epi8(6)));
+    shift = _mm_add_epi8(shift, _mm_and_si128(_mm_cmpgt_epi8(idx, _mm_set1_epi8(51)), _mm_set1_epi8(-75)));
+    shift = _mm_add_epi8(shift, _mm_and_si128(_mm_cmpeq_epi8(idx, _mm_set1_epi8(62)), _mm_set1_epi8(-15)));
+    shift = _mm_add_epi8(shift, _mm_and_si128(_mm_cmpeq_epi8(idx, _mm_set1_epi8(63)), _mm_set1_epi8(-12)));
+    return _mm_add_epi8(idx, shift);
+}
+
+// character to index, valid gets 0xFF in the bytes that are in the alphabet
+__attribute__((target("ssse3")))
+inline __m128i chars_to_indices_ssse3(__m128i c, __m128i &valid)
+{
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('A' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), c));
+    __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('a' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), c));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), c));
+    __m128i plus = _mm_cmpeq_epi8(c, _mm_set1_epi8('+'));
+    __m128i slash = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+    valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(_mm_or_si128(digit, plus), slash));
+
+    __m128i shift = _mm_and_si128(upper, _mm_set1_epi8(-65));
+    shift = _mm_or_si128(shift, _mm_and_si128(lower, _mm_set1_epi8(-71)));
+    shift = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(4)));
+    shift = _mm_or_si128(shift, _mm_and_si128(plus, _mm_set1_epi8(19)));
+    shift = _mm_or_si128(shift, _mm_and_si128(slash, _mm_set1_epi8(16)));
+    return _mm_add_epi8(c, shift);
+}
+
+// 16 indices to 12 bytes in the low lanes
+__attribute__((target("ssse3")))
+inline __m128i join_indices_ssse3(__m128i idx)
+{
+    __m128i ab_bc = _mm_maddubs_epi16(idx, _mm_set1_epi32(0x01400140));
+    __m128i abc = _mm_madd_epi16(ab_bc, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(abc, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+__attribute__((target("ssse3")))
+size_t encode_ssse3(const uint8_t *in, size_t n, char *out)
+{
+    size_t i = 0;
+    // 16 bytes are loaded for the 12 that are used
+    for (; i + 16 <= n; i += 12, out += 16)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), indices_to_chars_ssse3(split_indices_ssse3(x)));
+    }
+    return i;
+}
+
+__attribute__((target("ssse3")))
+size_t decode_ssse3(const char *in, size_t n, uint8_t *out)
+{
+    size_t i = 0;
+    // 16 bytes are stored for the 12 that are produced, 24 characters leave room for that
+    for (; i + 24 <= n; i += 16, out += 12)
+    {
+        __m128i valid;
+        __m128i idx = chars_to_indices_ssse3(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)), valid);
+        if (_mm_movemask_epi8(valid) != 0xFFFF) break;
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), join_indices_ssse3(idx));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t encode_avx2(const uint8_t *in, size_t n, char *out)
+{
+    size_t i = 0;
+    for (; i + 28 <= n; i += 24, out += 32)
+    {
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 12));
+        __m256i x = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+        x = _mm256_shuffle_epi8(x, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                                   10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+        __m256i t0 = _mm256_and_si256(x, _mm256_set1_epi32(0x0fc0fc00));
+        __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        __m256i t2 = _mm256_and_si256(x, _mm256_set1_epi32(0x003f03f0));
+        __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        __m256i idx = _mm256_or_si256(t1, t3);
+
+        __m256i shift = _mm256_set1_epi8('A');
+        shift = _mm256_add_epi8(shift, _mm256_and_si256(_mm256_cmpgt_epi8(idx, _mm256_set1_epi8(25)), _mm256_set1_epi8(6)));
+        shift = _mm256_add_epi8(shift, _mm256_and_si256(_mm256_cmpgt_epi8(idx, _mm256_set1_epi8(51)), _mm256_set1_epi8(-75)));
+        shift = _mm256_add_epi8(shift, _mm256_and_si256(_mm256_cmpeq_epi8(idx, _mm256_set1_epi8(62)), _mm256_set1_epi8(-15)));
+        shift = _mm256_add_epi8(shift, _mm256_and_si256(_mm256_cmpeq_epi8(idx, _mm256_set1_epi8(63)), _mm256_set1_epi8(-12)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_add_epi8(idx, shift));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t decode_avx2(const char *in, size_t n, uint8_t *out)
+{
+    size_t i = 0;
+    // the upper 12 bytes are stored as 16 at out + 12, 40 characters leave room for that
+    for (; i + 40 <= n; i += 32, out += 24)
+    {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('A' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), c));
+        __m256i lower = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), c));
+        __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+        __m256i plus = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('+'));
+        __m256i slash = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('/'));
+        __m256i valid = _mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(_mm256_or_si256(digit, plus), slash));
+        if (_mm256_movemask_epi8(valid) != -1) break;
+
+        __m256i shift = _mm256_and_si256(upper, _mm256_set1_epi8(-65));
+        shift = _mm256_or_si256(shift, _mm256_and_si256(lower, _mm256_set1_epi8(-71)));
+        shift = _mm256_or_si256(shift, _mm256_and_si256(digit, _mm256_set1_epi8(4)));
+        shift = _mm256_or_si256(shift, _mm256_and_si256(plus, _mm256_set1_epi8(19)));
+        shift = _mm256_or_si256(shift, _mm256_and_si256(slash, _mm256_set1_epi8(16)));
+        __m256i idx = _mm256_add_epi8(c, shift);
+
+        __m256i ab_bc = _mm256_maddubs_epi16(idx, _mm256_set1_epi32(0x01400140));
+        __m256i abc = _mm256_madd_epi16(ab_bc, _mm256_set1_epi32(0x00011000));
+        __m256i x = _mm256_shuffle_epi8(abc, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                                              2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(x));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 12), _mm256_extracti128_si256(x, 1));
+    }
+    return i;
+}
+
+#endif
+
+struct Kernels
+{
+    EncodeKernel encode = encode_scalar;
+    DecodeKernel decode = decode_scalar;
+    const char *name = "scalar";
+
+    Kernels()
+    {
+#ifdef BASE64_X86_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            encode = encode_avx2;
+            decode = decode_avx2;
+            name = "avx2";
+        } else if (__builtin_cpu_supports("ssse3")) {
+            encode = encode_ssse3;
+            decode = decode_ssse3;
+            name = "ssse3";
+        }
+#endif
+    }
+};
+
+const Kernels &kernels()
+{
+    static const Kernels k;
+    return k;
+}
+
+}
+
+void base64_encode(const uint8_t *in, size_t n, char *out)
+{
+    size_t i = kernels().encode(in, n, out);
+    i += encode_scalar(in + i, n - i, out + i / 3 * 4);
+    if (i == n) return;
+
+    // one or two bytes left, padded with '='
+    out += i / 3 * 4;
+    uint32_t x = uint32_t(in[i]) << 16;
+    if (i + 1 < n) x |= uint32_t(in[i+1]) << 8;
+    out[0] = encode_table[(x >> 18) & 0x3f];
+    out[1] = encode_table[(x >> 12) & 0x3f];
+    out[2] = i + 1 < n ? encode_table[(x >> 6) & 0x3f] : '=';
+    out[3] = '=';
+}
+
+bool base64_decode(const char *in, size_t n, uint8_t *out, size_t &out_size)
+{
+    out_size = 0;
+    if (n % 4 != 0) return false;
+    if (n == 0) return true;
+
+    // the last quantum may carry the padding, it is done by hand below
+    size_t body = n - 4;
+    size_t i = kernels().decode(in, body, out);
+    i += decode_scalar(in + i, body - i, out + i / 4 * 3);
+    out_size = i / 4 * 3;
+    if (i != body) return false;
+
+    const char *q = in + body;
+    uint8_t a = decode_table.value[uint8_t(q[0])];
+    uint8_t b = decode_table.value[uint8_t(q[1])];
+    uint8_t c = q[2] == '=' ? 0 : decode_table.value[uint8_t(q[2])];
+    uint8_t d = q[3] == '=' ? 0 : decode_table.value[uint8_t(q[3])];
+    if ((a | b | c | d) == INVALID) return false;
+    // "x=y=" is no padding, and the bits cut off by the padding have to be zero
+    if (q[2] == '=' && q[3] != '=') return false;
+    if (q[2] == '=' && (b & 0x0f)) return false;
+    if (q[3] == '=' && (c & 0x03)) return false;
+
+    uint32_t x = (uint32_t(a) << 18) | (uint32_t(b) << 12) | (uint32_t(c) << 6) | d;
+    out[out_size++] = uint8_t(x >> 16);
+    if (q[2] != '=') out[out_size++] = uint8_t(x >> 8);
+    if (q[3] != '=') out[out_size++] = uint8_t(x);
+    return true;
+}
+
+const char *base64_kernel_name()
+{
+    return kernels().name;
+}
@@ -0,0 +1,24 @@
+#ifndef RSA_TOOL_BASE64_H
+#define RSA_TOOL_BASE64_H
+
+#include <cstddef>
+#include <cstdint>
+
+// characters needed for n bytes, padding included
+inline size_t base64_encoded_size(size_t n) { return (n + 2) / 3 * 4; }
+// most bytes that n characters can decode to
+inline size_t base64_decoded_max_size(size_t n) { return n / 4 * 3; }
+
+// Writes base64_encoded_size(n) characters to out.
+void base64_encode(const uint8_t *in, size_t n, char *out);
+
+// Decodes n characters into out, which has room for base64_decoded_max_size(n) bytes.
+// Strict: n has to be a multiple of 4, only the alphabet is accepted and '=' only as
+// the padding of the last quantum. Returns false on invalid input, out_size then tells
+// where the first bad quantum starts (in bytes).
+bool base64_decode(const char *in, size_t n, uint8_t *out, size_t &out_size);
+
+// name of the kernel picked for this cpu: "avx2", "ssse3" or "scalar"
+const char *base64_kernel_name();
+
+#endif //RSA_TOOL_BASE64_H
@@ -5,11 +5,29 @@
 #ifndef RSA_TOOL_INTEGER_H
 #define RSA_TOOL_INTEGER_H
 
-#include <stack>
 #include <cmath>
+#include <cstdint>
 #include <sstream>
 #include <vector>
-#include <stack>
+#include <algorithm>
+#include <utility>
+#include <deque>
+#include <random>
+#include <array>
+
+#include "Ntt.h"
+
+// operands shorter than this many digits are multiplied by the schoolbook kernel,
+// override with -DINTEGER_KARATSUBA_THRESHOLD=n
+#ifndef INTEGER_KARATSUBA_THRESHOLD
+#define INTEGER_KARATSUBA_THRESHOLD 32
+#endif
+
+// operands of at least this many digits (twice as many for 64 bit digits, which the NTT has
+// to split) are multiplied through the NTT, override with -DINTEGER_NTT_THRESHOLD=n
+#ifndef INTEGER_NTT_THRESHOLD
+#define INTEGER_NTT_THRESHOLD 1024
+#endif
 
 template<typename T>
 short math_sign(T x)
@@ -22,69 +40,818 @@ short math_sign(T x)
 template<typename T>
 void swap(T &a, T &b)
 {
-    T t = a;
-    a = b;
-    b = t;
+    T t = std::move(a);
+    a = std::move(b);
+    b = std::move(t);
 }
 
-template<int DIGIT_NUM=2050, int DIGIT_VAL=10000, typename ElementType=int>
+// Describes how the digits of an Integer are combined.
+// WideType must be able to hold (base-1)*(base-1) + 2*(base-1).
+template<int DIGIT_VAL, typename ElementType>
+struct DigitTraits
+{
+    using WideType = unsigned long long;
+    static constexpr bool binary = false;
+    static constexpr WideType base = DIGIT_VAL;
+
+    static ElementType low(WideType x) { return ElementType(x % base); }
+    static WideType high(WideType x) { return x / base; }
+};
+
+// DIGIT_VAL = 0 selects the binary radix, where a digit takes the full width of ElementType.
+template<>
+struct DigitTraits<0, uint32_t>
+{
+    using WideType = uint64_t;
+    static constexpr bool binary = true;
+    static constexpr int bits = 32;
+    static constexpr WideType base = WideType(1) << bits;
+    // the largest power of 10 that fits in one digit, used by the decimal conversion
+    static constexpr int decimal_chunk_digits = 9;
+    static constexpr uint32_t decimal_chunk_val = 1000000000u;
+
+    static uint32_t low(WideType x) { return uint32_t(x); }
+    static WideType high(WideType x) { return x >> bits; }
+};
+
+#ifdef __SIZEOF_INT128__
+template<>
+struct DigitTraits<0, uint64_t>
+{
+    using WideType = unsigned __int128;
+    static constexpr bool binary = true;
+    static constexpr int bits = 64;
+    static constexpr WideType base = WideType(1) << bits;
+    static constexpr int decimal_chunk_digits = 19;
+    static constexpr uint64_t decimal_chunk_val = 10000000000000000000ull;
+
+    static uint64_t low(WideType x) { return uint64_t(x); }
+    static WideType high(WideType x) { return x >> bits; }
+};
+#endif
+
+// Digits are kept in a fixed array of DIGIT_NUM elements inside the Integer.
+template<int DIGIT_NUM, typename ElementType>
+class FixedDigitStorage
+{
+    ElementType data[DIGIT_NUM];
+public:
+    static constexpr size_t max_digits = DIGIT_NUM;
+
+    // the capacity is fixed, keep is the number of digits in use
+    void reserve(size_t /*n*/, size_t /*keep*/) {}
+
+    // nothing to take over, the digits have to be copied
+    bool steal(FixedDigitStorage &/*b*/) { return false; }
+
+    operator ElementType*() { return data; }
+    operator const ElementType*() const { return data; }
+};
+
+// Per thread free lists of digit blocks, one list for each power of two size.
+template<typename ElementType>
+class DigitPool
+{
+    static constexpr size_t CLASS_NUM = 48;
+    static constexpr size_t MAX_FREE_NUM = 64;
+    std::vector<ElementType*> free_list[CLASS_NUM];
+
+    // 0: not created yet, 1: alive, 2: destroyed with the thread
+    static int &_state()
+    {
+        thread_local int state = 0;
+        return state;
+    }
+
+    static DigitPool &_local()
+    {
+        thread_local DigitPool pool;
+        return pool;
+    }
+
+    DigitPool() { _state() = 1; }
+
+    ~DigitPool()
+    {
+        _state() = 2;
+        for (auto &l : free_list)
+        {
+            for (auto p : l) delete[] p;
+        }
+    }
+public:
+    // smallest size class that holds n digits
+    static unsigned size_class(size_t n)
+    {
+        unsigned c = 0;
+        while ((size_t(1) << c) < n) c += 1;
+        return c;
+    }
+
+    static ElementType *acquire(unsigned c)
+    {
+        if (_state() != 2) {
+            auto &l = _local().free_list[c];
+            if (!l.empty()) {
+                ElementType *p = l.back();
+                l.pop_back();
+                return p;
+            }
+        }
+        return new ElementType[size_t(1) << c];
+    }
+
+    static void release(ElementType *p, unsigned c)
+    {
+        if (_state() == 1) {
+            auto &l = _local().free_list[c];
+            if (l.size() < MAX_FREE_NUM) {
+                l.push_back(p);
+                return;
+            }
+        }
+        delete[] p;
+    }
+};
+
+// Small buffer storage, up to DIGIT_NUM digits live inside the Integer,
+// longer values move to a block from the DigitPool.
+template<int DIGIT_NUM, typename ElementType>
+class SmallDigitStorage
+{
+    ElementType inline_data[DIGIT_NUM];
+    ElementType *data;
+    size_t capacity;
+    unsigned size_class;
+
+    void _release()
+    {
+        if (data != inline_data) DigitPool<ElementType>::release(data, size_class);
+    }
+public:
+    static constexpr size_t max_digits = size_t(1) << 40;
+
+    SmallDigitStorage() : data(inline_data), capacity(DIGIT_NUM), size_class(0) {}
+    SmallDigitStorage(const SmallDigitStorage &) = delete;
+    SmallDigitStorage &operator=(const SmallDigitStorage &) = delete;
+    ~SmallDigitStorage() { _release(); }
+
+    // grow to at least n digits, the first keep digits are preserved
+    void reserve(size_t n, size_t keep)
+    {
+        if (n <= capacity) return;
+        unsigned c = DigitPool<ElementType>::size_class(n);
+        ElementType *p = DigitPool<ElementType>::acquire(c);
+        for (size_t i=0; i<keep; ++i) p[i] = data[i];
+        _release();
+        data = p;
+        capacity = size_t(1) << c;
+        size_class = c;
+    }
+
+    // take over the pooled block of b, returns false if b keeps its digits inline
+    bool steal(SmallDigitStorage &b)
+    {
+        if (b.data == b.inline_data) return false;
+        _release();
+        data = b.data;
+        capacity = b.capacity;
+        size_class = b.size_class;
+        b.data = b.inline_data;
+        b.capacity = DIGIT_NUM;
+        b.size_class = 0;
+        return true;
+    }
+
+    operator ElementType*() { return data; }
+    operator const ElementType*() const { return data; }
+};
+
+template<int DIGIT_NUM=2050, int DIGIT_VAL=10000, typename ElementType=int, template<int, typename> class Storage=FixedDigitStorage>
 class Integer{
-    ElementType digit_list[DIGIT_NUM];
+    using Traits = DigitTraits<DIGIT_VAL, ElementType>;
+    using WideType = typename Traits::WideType;
+    // below 4 digits splitting no longer shrinks the operands
+    static constexpr size_t karatsuba_threshold = INTEGER_KARATSUBA_THRESHOLD < 4 ? 4 : INTEGER_KARATSUBA_THRESHOLD;
+    // the NTT works on digits of at most 32 bits, a 64 bit digit takes two
+    static constexpr size_t ntt_pieces = Traits::binary ? sizeof(ElementType) / 4 : 1;
+    static constexpr size_t ntt_threshold = INTEGER_NTT_THRESHOLD * ntt_pieces;
+
+    Storage<DIGIT_NUM, ElementType> digit_list;
     size_t digit_size;
     short sign;
 
-    void _stream_element(std::stringstream &ss, size_t index, bool padding) const
+    void _reserve(size_t n)
+    {
+        digit_list.reserve(n, digit_size);
+    }
+
+    // drops leading zero digits, a zero value gets sign 0
+    void _trim()
     {
-        if (!padding && digit_list[index] == 0) {
-            ss<<'0';
+        while (digit_list[digit_size-1] == 0 && digit_size > 1) digit_size -= 1;
+        if (digit_size == 1 && digit_list[0] == 0) sign = 0;
+    }
+
+    enum ScratchSlot { SCRATCH_KARATSUBA, SCRATCH_PRODUCT, SCRATCH_DIVISOR, SCRATCH_QUOTIENT, SCRATCH_NUM };
+
+    // per thread buffers reused by the kernels, so that they do not allocate on every call
+    static ElementType *_scratch(ScratchSlot slot, size_t n)
+    {
+        thread_local std::vector<ElementType> scratch[SCRATCH_NUM];
+        if (scratch[slot].size() < n) scratch[slot].resize(n);
+        return scratch[slot].data();
+    }
+
+    static bool _use_ntt(size_t an, size_t bn)
+    {
+        return std::min(an, bn) >= ntt_threshold && (an + bn) * ntt_pieces <= NTT_MAX_SIZE;
+    }
+
+    // c[0, an+bn) = a * b through ntt_multiply, b == nullptr squares a
+    static void _mul_ntt(const ElementType *a, size_t an, const ElementType *b, size_t bn, ElementType *c)
+    {
+        if (!b) bn = an;
+        std::vector<uint32_t> pa(an * ntt_pieces), pb(b ? bn * ntt_pieces : 0), pc((an + bn) * ntt_pieces);
+        auto split = [](const ElementType *x, size_t n, uint32_t *out) {
+            for (size_t i=0; i<n; ++i)
+            {
+                for (size_t j=0; j<ntt_pieces; ++j) out[i*ntt_pieces + j] = uint32_t(uint64_t(x[i]) >> (32*j));
+            }
+        };
+        split(a, an, pa.data());
+        if (b) split(b, bn, pb.data());
+
+        const uint64_t base = Traits::binary ? uint64_t(1) << 32 : uint64_t(Traits::base);
+        ntt_multiply(pa.data(), pa.size(), b ? pb.data() : nullptr, pb.size(), base, pc.data());
+
+        for (size_t i=0; i<an+bn; ++i)
+        {
+            uint64_t x = 0;
+            for (size_t j=0; j<ntt_pieces; ++j) x |= uint64_t(pc[i*ntt_pieces + j]) << (32*j);
+            c[i] = ElementType(x);
+        }
+    }
+
+    // c[0, an+bn) = a * b, c must not overlap a or b
+    static void _mul_raw(const ElementType *a, size_t an, const ElementType *b, size_t bn, ElementType *c)
+    {
+        if (an < karatsuba_threshold || bn < karatsuba_threshold) {
+            _mul_school(a, an, b, bn, c);
+            return;
+        }
+        if (_use_ntt(an, bn)) {
+            _mul_ntt(a, an, b, bn, c);
+            return;
+        }
+        ElementType *scratch = _scratch(SCRATCH_KARATSUBA, _karatsuba_scratch_size(std::max(an, bn)));
+        _mul_karatsuba(a, an, b, bn, c, scratch);
+    }
+
+    // c[0, 2n) = a * a, c must not overlap a
+    static void _sqr_raw(const ElementType *a, size_t n, ElementType *c)
+    {
+        if (n < karatsuba_threshold) {
+            _sqr_school(a, n, c);
+            return;
+        }
+        if (_use_ntt(n, n)) {
+            _mul_ntt(a, n, nullptr, 0, c);
             return;
         }
+        ElementType *scratch = _scratch(SCRATCH_KARATSUBA, _karatsuba_scratch_size(n));
+        _sqr_karatsuba(a, n, c, scratch);
+    }
+
+    // |this| += |b|
+    void _add_abs_in_place(const Integer &b)
+    {
+        size_t n = std::max(digit_size, b.digit_size);
+        _reserve(n+1);
+        for (size_t i=digit_size; i<n; ++i) digit_list[i] = 0;
+        digit_size = n;
+        ElementType carry = _add_to(digit_list, n, b.digit_list, b.digit_size);
+        if (carry) digit_list[digit_size++] = carry;
+    }
 
-        std::stack<char> stack;
-        int t = DIGIT_VAL/10;
-        int x = digit_list[index];
-        while ((padding) ? t : x)
+    // |this| -= |b|, requires |this| >= |b|
+    void _sub_abs_in_place(const Integer &b)
+    {
+        _sub_from(digit_list, digit_size, b.digit_list, b.digit_size);
+        _trim();
+    }
+
+    // |this| = |b| - |this|, requires |b| >= |this|
+    void _rsub_abs_in_place(const Integer &b)
+    {
+        _reserve(b.digit_size);
+        WideType borrow = 0;
+        for (size_t i=0; i<b.digit_size; ++i)
         {
-            stack.push('0'+x%10);
-            t /= 10;
-            x /= 10;
+            WideType x = WideType(b.digit_list[i]) + Traits::base - (i < digit_size ? digit_list[i] : 0) - borrow;
+            digit_list[i] = Traits::low(x);
+            borrow = 1 - Traits::high(x);
+        }
+        digit_size = b.digit_size;
+        _trim();
+    }
+
+    // this += b_sign * |b|
+    void _add_signed(const Integer &b, short b_sign)
+    {
+        if (b_sign == 0) return;
+        if (sign == 0) {
+            *this = b;
+            sign = b_sign;
+            return;
+        }
+        if (sign == b_sign) _add_abs_in_place(b);
+        else if (compare_abs(b) >= 0) _sub_abs_in_place(b);
+        else {
+            _rsub_abs_in_place(b);
+            sign = b_sign;
+        }
+    }
+
+    // this = |this| mod |b|, quot receives |this| / |b| when it is not null.
+    // Both results are non-negative, like mod_div.
+    void _divmod_in_place(const Integer &b, Integer *quot)
+    {
+        if (compare_abs(b) < 0) {
+            if (quot) quot->zerofy();
+            if (sign != 0) sign = 1;
+            return;
+        }
+
+        if (b.digit_size == 1) {
+            ElementType d = b.digit_list[0];
+            if (sign != 0) sign = 1;
+            ElementType r = _div_small(d);
+            if (quot) *quot = std::move(*this);
+            digit_size = 1;
+            digit_list[0] = r;
+            sign = (r == 0) ? 0 : 1;
+            return;
+        }
+
+        // scale both operands so that the top digit of the divisor is at least base/2
+        size_t un = digit_size, vn = b.digit_size;
+        ElementType d = ElementType(Traits::base / (WideType(b.digit_list[vn-1]) + 1));
+        ElementType *v = _scratch(SCRATCH_DIVISOR, vn);
+        _mul_small_to(v, b.digit_list, vn, d);
+        _reserve(un+1);
+        digit_list[un] = _mul_small_to(digit_list, digit_list, un, d);
+
+        ElementType *q = _scratch(SCRATCH_QUOTIENT, un-vn+1);
+        _div_knuth(digit_list, un, v, vn, q);
+
+        if (quot) {
+            quot->digit_size = 0;
+            quot->_reserve(un-vn+1);
+            for (size_t i=0; i<un-vn+1; ++i) quot->digit_list[i] = q[i];
+            quot->digit_size = un-vn+1;
+            quot->sign = 1;
+            quot->_trim();
         }
 
-        while (!stack.empty())
+        digit_size = vn;
+        sign = 1;
+        _trim();
+        _div_small(d);
+    }
+
+    // Montgomery reduction on t[0, 2k+1), the result is left in t[k, 2k+1)
+    static void _montgomery_reduce_raw(ElementType *t, const ElementType *n, size_t k, ElementType n_inv)
+    {
+        for (size_t i=0; i<k; ++i)
         {
-            ss<<stack.top();
-            stack.pop();
+            ElementType m = Traits::low(WideType(t[i]) * n_inv);
+            WideType carry = 0;
+            for (size_t j=0; j<k; ++j)
+            {
+                WideType x = WideType(m) * n[j] + t[i+j] + carry;
+                t[i+j] = Traits::low(x);
+                carry = Traits::high(x);
+            }
+            for (size_t j=i+k; carry; ++j)
+            {
+                WideType x = WideType(t[j]) + carry;
+                t[j] = Traits::low(x);
+                carry = Traits::high(x);
+            }
         }
+
+        ElementType *r = t + k;
+        bool ge = r[k] != 0;
+        if (!ge) {
+            ge = true;
+            for (size_t i=k; i-- > 0;)
+            {
+                if (r[i] != n[i]) {
+                    ge = r[i] > n[i];
+                    break;
+                }
+            }
+        }
+        if (ge) _sub_from(r, k+1, n, k);
     }
 
-    ElementType _find_max_factor(Integer &b)
+    // c[0, an+bn) = a * b
+    static void _mul_school(const ElementType *a, size_t an, const ElementType *b, size_t bn, ElementType *c)
     {
-        for (ElementType i=DIGIT_VAL-1; i>=1; --i)
+        for (size_t i=0; i<an+bn; ++i) c[i] = 0;
+        for (size_t i=0; i<an; ++i)
         {
-            auto c = b.multiply_fast(i);
-            if (compare_abs(c) > 0)
+            WideType carry = 0;
+            WideType x = a[i];
+            for (size_t j=0; j<bn; ++j)
             {
-                return i;
+                WideType t = x * b[j] + c[i+j] + carry;
+                c[i+j] = Traits::low(t);
+                carry = Traits::high(t);
             }
+            c[i+bn] = ElementType(carry);
         }
-        return 0;
     }
 
-    ElementType _find_max_factor_bin(const Integer &b)
+    // c[0, 2n) = a * a, every cross product a[i]*a[j] (i < j) is computed once and doubled,
+    // then the squares a[i]^2 are added on the diagonal
+    static void _sqr_school(const ElementType *a, size_t n, ElementType *c)
+    {
+        for (size_t i=0; i<2*n; ++i) c[i] = 0;
+        for (size_t i=0; i+1<n; ++i)
+        {
+            WideType carry = 0;
+            WideType x = a[i];
+            for (size_t j=i+1; j<n; ++j)
+            {
+                WideType t = x * a[j] + c[i+j] + carry;
+                c[i+j] = Traits::low(t);
+                carry = Traits::high(t);
+            }
+            c[i+n] = ElementType(carry);
+        }
+        _add_to(c, 2*n, c, 2*n);
+
+        WideType carry = 0;
+        for (size_t i=0; i<n; ++i)
+        {
+            WideType x = WideType(a[i]) * a[i] + c[2*i] + carry;
+            c[2*i] = Traits::low(x);
+            WideType y = WideType(c[2*i+1]) + Traits::high(x);
+            c[2*i+1] = Traits::low(y);
+            carry = Traits::high(y);
+        }
+    }
+
+    // c[0, cn) += a[0, an), an <= cn, returns the carry out of c
+    static ElementType _add_to(ElementType *c, size_t cn, const ElementType *a, size_t an)
+    {
+        WideType carry = 0;
+        size_t i = 0;
+        for (; i<an; ++i)
+        {
+            WideType x = WideType(c[i]) + a[i] + carry;
+            c[i] = Traits::low(x);
+            carry = Traits::high(x);
+        }
+        for (; carry && i<cn; ++i)
+        {
+            WideType x = WideType(c[i]) + carry;
+            c[i] = Traits::low(x);
+            carry = Traits::high(x);
+        }
+        return ElementType(carry);
+    }
+
+    // c[0, cn) -= a[0, an), an <= cn, returns the borrow out of c
+    static ElementType _sub_from(ElementType *c, size_t cn, const ElementType *a, size_t an)
+    {
+        WideType borrow = 0;
+        size_t i = 0;
+        for (; i<an; ++i)
+        {
+            WideType x = WideType(c[i]) + Traits::base - a[i] - borrow;
+            c[i] = Traits::low(x);
+            borrow = 1 - Traits::high(x);
+        }
+        for (; borrow && i<cn; ++i)
+        {
+            WideType x = WideType(c[i]) + Traits::base - borrow;
+            c[i] = Traits::low(x);
+            borrow = 1 - Traits::high(x);
+        }
+        return ElementType(borrow);
+    }
+
+    // c[0, n) = a[0, n) * m, returns the carry digit
+    static ElementType _mul_small_to(ElementType *c, const ElementType *a, size_t n, ElementType m)
+    {
+        WideType carry = 0;
+        for (size_t i=0; i<n; ++i)
+        {
+            WideType x = WideType(a[i]) * m + carry;
+            c[i] = Traits::low(x);
+            carry = Traits::high(x);
+        }
+        return ElementType(carry);
+    }
+
+    static size_t _karatsuba_scratch_size(size_t n)
+    {
+        return 4*n + 256;
+    }
+
+    // c[0, an+bn) = a * b, scratch must hold _karatsuba_scratch_size(max(an, bn)) digits
+    static void _mul_karatsuba(const ElementType *a, size_t an, const ElementType *b, size_t bn, ElementType *c, ElementType *scratch)
+    {
+        if (an < bn) {
+            std::swap(a, b);
+            std::swap(an, bn);
+        }
+        if (bn < karatsuba_threshold) {
+            _mul_school(a, an, b, bn, c);
+            return;
+        }
+
+        if (2*bn <= an) {
+            // unbalanced, multiply b by bn sized slices of a
+            for (size_t i=0; i<an+bn; ++i) c[i] = 0;
+            ElementType *t = scratch;
+            for (size_t i=0; i<an; i += bn)
+            {
+                size_t n = std::min(bn, an-i);
+                _mul_karatsuba(a+i, n, b, bn, t, scratch + 2*bn);
+                _add_to(c+i, an+bn-i, t, n+bn);
+            }
+            return;
+        }
+
+        // a = a1*base^m + a0, b = b1*base^m + b0, with 0 < bn-m <= an-m
+        size_t m = an/2;
+        size_t h = an - m;
+        const ElementType *a0 = a, *a1 = a+m, *b0 = b, *b1 = b+m;
+
+        _mul_karatsuba(a0, m, b0, m, c, scratch);
+        _mul_karatsuba(a1, an-m, b1, bn-m, c+2*m, scratch);
+
+        // z1 = (a0+a1)(b0+b1) - a0*b0 - a1*b1
+        ElementType *sa = scratch, *sb = scratch + h+1, *z1 = scratch + 2*(h+1);
+        for (size_t i=0; i<h+1; ++i) sa[i] = sb[i] = 0;
+        for (size_t i=0; i<m; ++i) sa[i] = a0[i], sb[i] = b0[i];
+        sa[h] = _add_to(sa, h, a1, an-m);
+        sb[h] = _add_to(sb, h, b1, bn-m);
+        _mul_karatsuba(sa, h+1, sb, h+1, z1, scratch + 4*(h+1));
+        _sub_from(z1, 2*(h+1), c, 2*m);
+        _sub_from(z1, 2*(h+1), c+2*m, an+bn-2*m);
+
+        size_t z1n = 2*(h+1);
+        while (z1n > 0 && z1[z1n-1] == 0) z1n -= 1;
+        _add_to(c+m, an+bn-m, z1, z1n);
+    }
+
+    // c[0, 2n) = a * a, scratch must hold _karatsuba_scratch_size(n) digits.
+    // Karatsuba with one half product less: z1 = (a0+a1)^2 - a0^2 - a1^2.
+    static void _sqr_karatsuba(const ElementType *a, size_t n, ElementType *c, ElementType *scratch)
+    {
+        if (n < karatsuba_threshold) {
+            _sqr_school(a, n, c);
+            return;
+        }
+
+        size_t m = n/2;
+        size_t h = n - m;
+        const ElementType *a0 = a, *a1 = a+m;
+
+        _sqr_karatsuba(a0, m, c, scratch);
+        _sqr_karatsuba(a1, h, c+2*m, scratch);
+
+        ElementType *sa = scratch, *z1 = scratch + h+1;
+        for (size_t i=0; i<h+1; ++i) sa[i] = 0;
+        for (size_t i=0; i<m; ++i) sa[i] = a0[i];
+        sa[h] = _add_to(sa, h, a1, h);
+        _sqr_karatsuba(sa, h+1, z1, scratch + 3*(h+1));
+        _sub_from(z1, 2*(h+1), c, 2*m);
+        _sub_from(z1, 2*(h+1), c+2*m, 2*h);
+
+        size_t z1n = 2*(h+1);
+        while (z1n > 0 && z1[z1n-1] == 0) z1n -= 1;
+        _add_to(c+m, 2*n-m, z1, z1n);
+    }
+
+    // Knuth's Algorithm D on a normalized divisor (v[vn-1] >= base/2, vn >= 2).
+    // u[0, un] (one digit longer than the dividend, top digit may be 0) is replaced
+    // by the remainder in its low vn digits, q receives un-vn+1 quotient digits.
+    static void _div_knuth(ElementType *u, size_t un, const ElementType *v, size_t vn, ElementType *q)
     {
-        ElementType l=1, r=DIGIT_VAL;
-        while((r-l) > 1)
+        const WideType v1 = v[vn-1], v2 = v[vn-2];
+        for (size_t j=un-vn+1; j-- > 0;)
         {
-            auto m = (l+r)/2;
-            auto c = b.multiply_fast(m);
-            auto cmp = c.compare_abs(*this);
-            if (cmp > 0) r = m;
-            else l = m;
+            // estimate the quotient digit from the top two digits, it is at most 2 too large
+            WideType num = WideType(u[j+vn]) * Traits::base + u[j+vn-1];
+            WideType qhat = num / v1, rhat = num % v1;
+            while (qhat >= Traits::base || qhat * v2 > rhat * Traits::base + u[j+vn-2])
+            {
+                qhat -= 1;
+                rhat += v1;
+                if (rhat >= Traits::base) break;
+            }
+
+            // u[j, j+vn] -= qhat * v
+            WideType carry = 0, borrow = 0;
+            for (size_t i=0; i<vn; ++i)
+            {
+                WideType p = qhat * v[i] + carry;
+                carry = Traits::high(p);
+                WideType x = WideType(u[i+j]) + Traits::base - Traits::low(p) - borrow;
+                u[i+j] = Traits::low(x);
+                borrow = 1 - Traits::high(x);
+            }
+            WideType x = WideType(u[j+vn]) + Traits::base - carry - borrow;
+            u[j+vn] = Traits::low(x);
+
+            if (Traits::high(x) == 0) {
+                // the estimate was one too large, add v back
+                qhat -= 1;
+                _add_to(u+j, vn, v, vn);
+                u[j+vn] = 0;
+            }
+            q[j] = ElementType(qhat);
         }
-        return l;
+    }
+
+    // divides the absolute value by a single digit in place, returns the remainder
+    ElementType _div_small(ElementType d)
+    {
+        WideType rem = 0;
+        for (size_t i=digit_size-1;; --i)
+        {
+            WideType cur = rem * Traits::base + digit_list[i];
+            digit_list[i] = ElementType(cur / d);
+            rem = cur % d;
+            if (i == 0) break;
+        }
+        while (digit_list[digit_size-1] == 0 && digit_size > 1) digit_size -= 1;
+        if (digit_size == 1 && digit_list[0] == 0) sign = 0;
+        return ElementType(rem);
+    }
+
+    // this = this * m + a, on the absolute value
+    void _mul_add_small(ElementType m, ElementType a)
+    {
+        _reserve(digit_size+1);
+        WideType carry = a;
+        for (size_t i=0; i<digit_size; ++i)
+        {
+            WideType x = WideType(digit_list[i]) * m + carry;
+            digit_list[i] = Traits::low(x);
+            carry = Traits::high(x);
+        }
+        if (carry) digit_list[digit_size++] = ElementType(carry);
+        while (digit_list[digit_size-1] == 0 && digit_size > 1) digit_size -= 1;
+    }
+
+    // Decimal conversion of the binary backends. Longer numbers are split in halves at a power
+    // 10^(decimal_chunk_digits * 2^i), so that the work goes into balanced multiplications
+    // (and Barrett divisions built on them) instead of one digit at a time passes.
+    static constexpr size_t decimal_dc_limbs = 16;
+
+    struct DecimalPower
+    {
+        Integer pow; // 10^(decimal_chunk_digits * 2^i)
+        Integer mu; // base^(2k) / pow with k = pow.digit_size, 0 until a division needs it
+    };
+
+    // per thread table of the powers, a deque so that references stay valid while it grows
+    static DecimalPower &_decimal_power(size_t level)
+    {
+        thread_local std::deque<DecimalPower> table;
+        while (table.size() <= level)
+        {
+            DecimalPower p;
+            if (table.empty()) {
+                p.pow.digit_list[0] = Traits::decimal_chunk_val;
+                p.pow.sign = 1;
+            } else mul_into(p.pow, table.back().pow, table.back().pow);
+            table.push_back(std::move(p));
+        }
+        return table[level];
+    }
+
+    // q = x / p.pow, r = x % p.pow for 0 <= x < p.pow^2
+    static void _divmod_decimal_power(const Integer &x, DecimalPower &p, Integer &q, Integer &r)
+    {
+        const size_t k = p.pow.digit_size;
+        // base^(2k) does not fit a fixed storage near its limit, Knuth division does
+        if (2*k + 2 > Storage<DIGIT_NUM, ElementType>::max_digits) {
+            r = x.abs();
+            r._divmod_in_place(p.pow, &q);
+            return;
+        }
+        if (p.mu.sign == 0) p.mu = Integer(1).left_shift(int(2*k)) / p.pow;
+
+        mul_into(q, x.right_shift(int(k-1)), p.mu);
+        q = q.right_shift(int(k+1));
+        mul_into(r, q, p.pow);
+        r._rsub_abs_in_place(x);
+        r.sign = 1;
+        r._trim();
+        // the estimate is at most two below the quotient
+        while (r.compare_abs(p.pow) >= 0)
+        {
+            r._sub_abs_in_place(p.pow);
+            r._trim();
+            q._add_abs_in_place(Integer(1));
+            q.sign = 1;
+        }
+    }
+
+    // writes |x| < 10^(decimal_chunk_digits * 2^level) as exactly that many digits, zero padded
+    static void _write_decimal(const Integer &x, size_t level, char *out)
+    {
+        const size_t width = size_t(Traits::decimal_chunk_digits) << level;
+        if (level == 0 || x.digit_size <= decimal_dc_limbs) {
+            Integer t(x);
+            char *p = out + width;
+            while (p > out && !(t.digit_size == 1 && t.digit_list[0] == 0))
+            {
+                ElementType r = t._div_small(Traits::decimal_chunk_val);
+                for (int i=0; i<Traits::decimal_chunk_digits; ++i)
+                {
+                    *--p = char('0' + r % 10);
+                    r /= 10;
+                }
+            }
+            while (p > out) *--p = '0';
+            return;
+        }
+
+        Integer q, r;
+        _divmod_decimal_power(x, _decimal_power(level-1), q, r);
+        _write_decimal(q, level-1, out);
+        _write_decimal(r, level-1, out + width/2);
+    }
+
+    // |this| = the decimal digits s[0, len)
+    void _read_decimal(const char *s, size_t len)
+    {
+        const size_t chunk = Traits::decimal_chunk_digits;
+        if (len <= decimal_dc_limbs * chunk) {
+            digit_size = 1;
+            digit_list[0] = 0;
+            size_t first = len % chunk;
+            if (first == 0) first = chunk;
+            for (size_t i=0; i<len;)
+            {
+                size_t n = (i == 0) ? first : chunk;
+                ElementType m = 1, x = 0;
+                for (size_t j=0; j<n; ++j, ++i)
+                {
+                    m *= 10;
+                    x = x * 10 + (s[i]-'0');
+                }
+                _mul_add_small(m, x);
+            }
+            sign = 1;
+            _trim();
+            return;
+        }
+
+        // the low part takes the largest chunk * 2^level digits that leave some for the high part
+        size_t level = 0;
+        while ((chunk << (level+1)) < len) level += 1;
+        const size_t low_len = chunk << level;
+        Integer high, low;
+        high._read_decimal(s, len - low_len);
+        low._read_decimal(s + len - low_len, low_len);
+        mul_into(*this, high, _decimal_power(level).pow);
+        _add_signed(low, low.sign);
+    }
+
+    void _from_decimal_binary(const std::string &s, size_t begin)
+    {
+        _read_decimal(s.data() + begin, s.size() - begin);
+    }
+
+    std::string _to_decimal_binary() const
+    {
+        // bits * log10(2) < bits * 0.30103 bounds the number of digits
+        size_t digits = bit_length() * 30103 / 100000 + 1;
+        size_t level = 0;
+        while ((size_t(Traits::decimal_chunk_digits) << level) < digits) level += 1;
+
+        std::string s(size_t(Traits::decimal_chunk_digits) << level, '0');
+        _write_decimal(*this, level, s.data());
+        size_t lead = s.find_first_not_of('0');
+        s.erase(0, lead == std::string::npos ? s.size() - 1 : lead);
+        return s;
     }
 public:
-    inline size_t get_digit_size() {
+    using DigitType = ElementType;
+    static constexpr unsigned long long max_digit = (unsigned long long)(Traits::base - 1);
+    static constexpr int digit_val = DIGIT_VAL; // 0 for binary digits
+
+    inline size_t get_digit_size() const {
         return digit_size;
     }
 
@@ -103,15 +870,18 @@ public:
         }
         digit_size = 0;
         sign = math_sign(x);
-        while (x) {
-            auto q = x % DIGIT_VAL;
-            x /= DIGIT_VAL;
-            digit_list[digit_size] = q;
+        WideType ux = (x < 0) ? -(unsigned long long)x : (unsigned long long)x;
+        _reserve(20);
+        while (ux) {
+            digit_list[digit_size] = Traits::low(ux);
+            ux = Traits::high(ux);
             digit_size += 1;
         }
     }
 
     Integer(const std::string &s, bool raw = false) {
+        digit_size = 0;
+        _reserve(s.size()+1);
         if (raw) {
             for (size_t i=0; i<s.size(); ++i) digit_list[i] = s[i];
             digit_size = s.size();
@@ -120,6 +890,12 @@ public:
         }
         short has_sign = 0;
         if (!s.empty()) has_sign = (s[0] == '-' || s[0] == '+') ? 1 : 0;
+        if constexpr (Traits::binary) {
+            _from_decimal_binary(s, has_sign);
+            if (s.empty()) sign = 0;
+            else sign = (digit_size==1&&digit_list[0]==0) ? 0 : (s[0] == '-' ? -1 : 1);
+            return;
+        }
         digit_size = 0;
         int x = 0;
         int t = 1;
@@ -142,6 +918,8 @@ public:
 
     Integer(const Integer& b)
     {
+        digit_size = 0;
+        _reserve(b.digit_size);
         digit_size = b.digit_size;
         sign = b.sign;
         for (size_t i=0; i<b.digit_size; ++i)
@@ -150,15 +928,54 @@ public:
         }
     }
 
+    Integer &operator=(const Integer &b)
+    {
+        if (this == &b) return *this;
+        digit_size = 0;
+        _reserve(b.digit_size);
+        digit_size = b.digit_size;
+        sign = b.sign;
+        for (size_t i=0; i<b.digit_size; ++i)
+        {
+            digit_list[i] = b.digit_list[i];
+        }
+        return *this;
+    }
+
+    Integer(Integer &&b) noexcept
+    {
+        digit_size = 0;
+        if (!digit_list.steal(b.digit_list)) {
+            _reserve(b.digit_size);
+            for (size_t i=0; i<b.digit_size; ++i) digit_list[i] = b.digit_list[i];
+        }
+        digit_size = b.digit_size;
+        sign = b.sign;
+        b.zerofy();
+    }
+
+    Integer &operator=(Integer &&b) noexcept
+    {
+        if (this == &b) return *this;
+        digit_size = 0;
+        if (!digit_list.steal(b.digit_list)) {
+            _reserve(b.digit_size);
+            for (size_t i=0; i<b.digit_size; ++i) digit_list[i] = b.digit_list[i];
+        }
+        digit_size = b.digit_size;
+        sign = b.sign;
+        b.zerofy();
+        return *this;
+    }
+
     long long to_int() const {
-        unsigned long long x = 0;
-        for (size_t i=digit_size-1; i>=0; --i)
+        WideType x = 0;
+        for (size_t i=digit_size-1;; --i)
         {
-            x += digit_list[i];
+            x = x * Traits::base + digit_list[i];
             if (i == 0) break;
-            else x *= DIGIT_VAL;
         }
-        return x * sign;
+        return (long long)(unsigned long long)x * sign;
     }
 
     std::string to_string(bool raw=false) const {
@@ -170,18 +987,33 @@ public:
             return s;
         }
 
-        std::stringstream ss;
-        if (sign < 0) ss<<"-";
+        if constexpr (Traits::binary) {
+            if (sign < 0) return "-" + _to_decimal_binary();
+            return _to_decimal_binary();
+        }
 
-        for (size_t i=digit_size-1;; --i)
+        // every digit but the top one takes exactly element_width characters
+        int element_width = 0;
+        for (long long t=1; t<DIGIT_VAL; t*=10) element_width += 1;
+        std::string top = std::to_string(digit_list[digit_size-1]);
+        std::string s(size_t(sign < 0) + top.size() + (digit_size-1) * element_width, '0');
+        char *p = s.data();
+        if (sign < 0) *p++ = '-';
+        p = std::copy(top.begin(), top.end(), p);
+        for (size_t i=digit_size-1; i-- > 0;)
         {
-            _stream_element(ss, i, i<digit_size-1 && digit_size!=1);
-            if (i == 0) break;
+            ElementType x = digit_list[i];
+            for (int j=element_width-1; j>=0; --j)
+            {
+                p[j] = char('0' + x % 10);
+                x /= 10;
+            }
+            p += element_width;
         }
-        return ss.str();
+        return s;
     }
 
-    Integer abs(){
+    Integer abs() const {
         Integer c(*this);
         if (c.sign < 0) c.sign = 1;
         return c;
@@ -209,142 +1041,146 @@ public:
         if (sign == 0 && b.sign == 0) return 0;
 
         short res = compare_abs(b);
-        if (sign > 0) return res;
-        if (sign < 0) return -res;
+        return sign > 0 ? res : -res;
     }
 
-    Integer add_abs(const Integer &_b) const
+    // |this| + |b|, with the sign of the larger operand
+    Integer add_abs(const Integer &b) const
     {
-        Integer _tb(_b);
-        Integer _ta(*this);
-        Integer *ap = &_ta;
-        Integer *bp = &_tb;
-        if (ap->compare_abs(*bp) < 0) swap(ap, bp);
-        Integer &a = *ap;
-        Integer &b = *bp;
-        Integer c = a;
-
-        for (size_t i=0; i<b.digit_size; ++i)
-        {
-            c.digit_list[i] += b.digit_list[i];
-            if (c.digit_list[i] >= DIGIT_VAL) {
-                if (i+1 == c.digit_size) {
-                    c.digit_size += 1;
-                    c.digit_list[c.digit_size-1] = 0;
-                }
-                c.digit_list[i+1] += c.digit_list[i] / DIGIT_VAL;
-                c.digit_list[i] %= DIGIT_VAL;
-            }
-        }
+        Integer c(*this);
+        if (compare_abs(b) < 0) c.sign = b.sign;
+        c._add_abs_in_place(b);
+        return c;
+    }
 
-        for (size_t i=b.digit_size; i<c.digit_size-1; ++i)
-        {
-            if (c.digit_list[i] >= DIGIT_VAL) {
-                c.digit_list[i+1] += c.digit_list[i] / DIGIT_VAL;
-                c.digit_list[i] %= DIGIT_VAL;
-            } else break;
+    // |larger| - |smaller|, with the sign of the larger operand
+    Integer sub_abs(const Integer &b) const
+    {
+        if (compare_abs(b) < 0) {
+            Integer c(b);
+            c._sub_abs_in_place(*this);
+            return c;
         }
+        Integer c(*this);
+        c._sub_abs_in_place(b);
+        return c;
+    }
 
-        while (c.digit_list[c.digit_size-1] >= DIGIT_VAL) {
-            c.digit_list[c.digit_size] = c.digit_list[c.digit_size-1] / DIGIT_VAL;
-            c.digit_list[c.digit_size-1] %= DIGIT_VAL;
-            c.digit_size += 1;
-        }
+    Integer add(const Integer &b) const
+    {
+        Integer c(*this);
+        c += b;
+        return c;
+    }
 
+    Integer sub(const Integer &b) const
+    {
+        Integer c(*this);
+        c -= b;
         return c;
     }
 
-    Integer sub_abs(const Integer &_b) const
+    Integer &operator+=(const Integer &b)
     {
-        Integer _tb(_b);
-        Integer _ta(*this);
-        Integer *ap = &_ta;
-        Integer *bp = &_tb;
-        if (ap->compare_abs(*bp) < 0) swap(ap, bp);
-        Integer &a = *ap;
-        Integer &b = *bp;
-        Integer c = a;
+        _add_signed(b, b.sign);
+        return *this;
+    }
 
-        for (size_t i=0; i<b.digit_size; ++i)
-        {
-            c.digit_list[i] -= b.digit_list[i];
-            if (c.digit_list[i] < 0)
-            {
-                c.digit_list[i+1] -= 1;
-                c.digit_list[i] += DIGIT_VAL;
-            }
-        }
+    Integer &operator-=(const Integer &b)
+    {
+        _add_signed(b, -b.sign);
+        return *this;
+    }
 
-        for (size_t i=b.digit_size; i<c.digit_size-1; ++i)
-        {
-            if (c.digit_list[i] < 0)
-            {
-                c.digit_list[i+1] -= 1;
-                c.digit_list[i] += DIGIT_VAL;
-            }
-        }
+    Integer &operator*=(const Integer &b)
+    {
+        mul_into(*this, *this, b);
+        return *this;
+    }
 
-        while (c.digit_list[c.digit_size-1] == 0 && c.digit_size > 1) c.digit_size -= 1;
+    Integer &operator/=(const Integer &b)
+    {
+        auto cmp = compare_abs(b);
+        if (cmp == 0) *this = Integer(1);
+        else if (cmp < 0) zerofy();
+        else {
+            Integer q;
+            _divmod_in_place(b, &q);
+            *this = std::move(q);
+        }
+        return *this;
+    }
 
-        return c;
+    Integer &operator%=(const Integer &b)
+    {
+        auto cmp = compare_abs(b);
+        if (cmp == 0) zerofy();
+        else if (cmp > 0) _divmod_in_place(b, nullptr);
+        return *this;
     }
 
-    Integer add(const Integer &b) const
+    // dst = a * b, dst may be one of the operands
+    static void mul_into(Integer &dst, const Integer &a, const Integer &b)
     {
-        if (sign == 0) return b;
-        if (b.sign == 0) return *this;
-        if (sign == b.sign) {
-            Integer c = add_abs(b);
-            c.sign = sign;
-            return c;
+        if (&dst == &a || &dst == &b) {
+            Integer c;
+            mul_into(c, a, b);
+            dst = std::move(c);
+            return;
         }
-        Integer c = sub_abs(b);
-        if (compare_abs(b) > 0){
-            c.sign = sign;
-        } else c.sign = b.sign;
-        return c;
+        dst.digit_size = 0;
+        dst._reserve(a.digit_size + b.digit_size);
+        _mul_raw(a.digit_list, a.digit_size, b.digit_list, b.digit_size, dst.digit_list);
+        dst.digit_size = a.digit_size + b.digit_size;
+        dst.sign = a.sign * b.sign;
+        dst._trim();
     }
 
-    Integer sub(const Integer &b) const
+    // dst = a * b mod n, dst may be one of the operands
+    static void mul_mod_into(Integer &dst, const Integer &a, const Integer &b, const Integer &n)
     {
-        if (sign == 0) {
-            Integer c = b;
-            c.sign *= -1;
-            return c;
+        mul_into(dst, a, b);
+        dst %= n;
+    }
+
+    // dst = a * a, dst may be a
+    static void square_into(Integer &dst, const Integer &a)
+    {
+        if (&dst == &a) {
+            Integer c;
+            square_into(c, a);
+            dst = std::move(c);
+            return;
         }
-        if (b.sign == 0) return *this;
-        Integer new_b = b;
-        new_b.sign *= -1;
-        return add(new_b);
+        dst.digit_size = 0;
+        dst._reserve(2*a.digit_size);
+        _sqr_raw(a.digit_list, a.digit_size, dst.digit_list);
+        dst.digit_size = 2*a.digit_size;
+        dst.sign = a.sign * a.sign;
+        dst._trim();
+    }
+
+    // dst = a * a mod n, dst may be a
+    static void square_mod_into(Integer &dst, const Integer &a, const Integer &n)
+    {
+        square_into(dst, a);
+        dst %= n;
+    }
+
+    Integer square() const
+    {
+        Integer c;
+        square_into(c, *this);
+        return c;
     }
 
     Integer multiply(const Integer &b) const
     {
         const Integer &a = *this;
         Integer c;
+        c._reserve(a.digit_size + b.digit_size);
         c.digit_size = a.digit_size + b.digit_size;
-        for (size_t i=0; i<c.digit_size; ++i) c.digit_list[i] = 0;
-
-        for (size_t i=0; i<a.digit_size; ++i)
-        {
-            for (size_t j=0; j<b.digit_size; ++j)
-            {
-                c.digit_list[i+j] += a.digit_list[i] * b.digit_list[j];
-            }
-        }
-
-        for (size_t i=0; i<c.digit_size; ++i)
-        {
-            if (c.digit_list[i] >= DIGIT_VAL)
-            {
-                if (i == c.digit_size-1)
-                {
-                    c.digit_list[c.digit_size++] = 0;
-                }
-                c.digit_list[i+1] += c.digit_list[i] / DIGIT_VAL;
-                c.digit_list[i] %= DIGIT_VAL;
-            }
-        }
+        _mul_school(a.digit_list, a.digit_size, b.digit_list, b.digit_size, c.digit_list);
 
         while (c.digit_list[c.digit_size-1] == 0 && c.digit_size > 1) c.digit_size -= 1;
 
@@ -357,14 +1193,15 @@ public:
         const Integer &a = *this;
         Integer c;
         c.sign = a.sign;
-        c.digit_size = a.digit_size + n;
-        if (c.digit_size > DIGIT_NUM) {
+        if (a.digit_size + n > Storage<DIGIT_NUM, ElementType>::max_digits) {
             c.digit_size = 0;
             c.digit_list[0] = 0;
             c.sign = 0;
             return c;
         }
-        for (int i=0; i<a.digit_size; ++i)
+        c._reserve(a.digit_size + n);
+        c.digit_size = a.digit_size + n;
+        for (size_t i=0; i<a.digit_size; ++i)
         {
             c.digit_list[i+n] = a.digit_list[i];
         }
@@ -382,14 +1219,15 @@ public:
         const Integer &a = *this;
         Integer c;
         c.sign = a.sign;
-        c.digit_size = a.digit_size - n;
-        if (a.digit_size <= n) {
+        if (a.digit_size <= size_t(n)) {
             c.digit_size = 1;
             c.digit_list[0] = 0;
             c.sign = 0;
             return c;
         }
-        for (int i=0; i<c.digit_size; ++i)
+        c._reserve(a.digit_size - n);
+        c.digit_size = a.digit_size - n;
+        for (size_t i=0; i<c.digit_size; ++i)
         {
             c.digit_list[i] = a.digit_list[i+n];
         }
@@ -402,6 +1240,7 @@ public:
         const Integer &a = *this;
         if (a.digit_size <= n) return a;
         Integer c;
+        c._reserve(n);
         c.digit_size = n;
         c.sign = a.sign;
         for (size_t i=0; i<c.digit_size; ++i)
@@ -430,107 +1269,282 @@ public:
 
     Integer multiply_fast(const Integer &B) const
     {
-        const Integer &A = *this;
-        if (A.digit_size == 1 || B.digit_size == 1) return A.multiply(B);
-
-        int an = A.digit_size;
-        int a_pivot = an/2;
-        Integer a = A.right_shift(a_pivot);
-        Integer b = A.extract(a_pivot);
+        Integer c;
+        mul_into(c, *this, B);
+        return c;
+    }
 
-//        std::cout<<">=====| Divide Start |=====<"<<std::endl;
-//        std::cout<<A.to_string()<<" = "<<a.to_string()<<"x10^"<<a_pivot<<" + "<<b.to_string()<<std::endl;
+    void zerofy()
+    {
+        digit_size = 1;
+        digit_list[0] = 0;
+        sign = 0;
+    }
 
-        int bn = B.digit_size;
-        int b_pivot = bn/2;
-        Integer c = B.right_shift(b_pivot);
-        Integer d = B.extract(b_pivot);
-//        std::cout<<B.to_string()<<" = "<<c.to_string()<<"x10^"<<b_pivot<<" + "<<d.to_string()<<std::endl;
+    // r[i] = |this| mod d[i] for n single digit divisors, in one pass over the digits
+    void mod_small_many(const ElementType *d, size_t n, ElementType *r) const
+    {
+        for (size_t j=0; j<n; ++j) r[j] = 0;
+        for (size_t i=digit_size; i-- > 0;)
+        {
+            WideType x = digit_list[i];
+            for (size_t j=0; j<n; ++j) r[j] = ElementType((WideType(r[j]) * Traits::base + x) % d[j]);
+        }
+    }
 
-        auto res1 = a.multiply_fast(c).left_shift(a_pivot+b_pivot);
-//        std::cout<<"res1: ac10 = "<<a.to_string()<<" x "<<c.to_string()<<" x 10^"<<a_pivot+b_pivot<<" = "<<res1.to_string()<<std::endl;
+    // bits of the absolute value, the least significant bit first
+    std::vector<uint8_t> to_bits() const
+    {
+        std::vector<uint8_t> bits;
+        if constexpr (Traits::binary) {
+            bits.reserve(digit_size * Traits::bits);
+            for (size_t i=0; i<digit_size; ++i)
+            {
+                for (int j=0; j<Traits::bits; ++j) bits.push_back((digit_list[i] >> j) & 1);
+            }
+        } else {
+            // peel off the largest power of two below the base at a time
+            int chunk_bits = 0;
+            while ((WideType(1) << (chunk_bits+1)) < Traits::base) chunk_bits += 1;
+            Integer t(*this);
+            while (!(t.digit_size == 1 && t.digit_list[0] == 0))
+            {
+                ElementType r = t._div_small(ElementType(1) << chunk_bits);
+                for (int j=0; j<chunk_bits; ++j) bits.push_back((r >> j) & 1);
+            }
+        }
+        while (!bits.empty() && bits.back() == 0) bits.pop_back();
+        return bits;
+    }
 
-        auto res2 = a.multiply_fast(d).left_shift(a_pivot);
-//        std::cout<<"res2: ad10 = "<<a.to_string()<<" x "<<d.to_string()<<" x 10^"<<a_pivot<<" = "<<res2.to_string()<<std::endl;
+    // number of bits of the absolute value, 0 for zero
+    size_t bit_length() const
+    {
+        if constexpr (Traits::binary) {
+            ElementType top = digit_list[digit_size-1];
+            size_t n = (digit_size-1) * Traits::bits;
+            while (top) {
+                n += 1;
+                top >>= 1;
+            }
+            return n;
+        } else {
+            return to_bits().size();
+        }
+    }
 
-        auto res3 = b.multiply_fast(c).left_shift(b_pivot);
-//        std::cout<<"res3: bc10 = "<<b.to_string()<<" x "<<c.to_string()<<" x 10^"<<b_pivot<<" = "<<res3.to_string()<<std::endl;
+    // |this| as a big-endian byte string of exactly width bytes, false if it needs more
+    bool to_bytes(uint8_t *out, size_t width) const
+    {
+        if constexpr (Traits::binary) {
+            const size_t bytes_per_digit = Traits::bits / 8;
+            for (size_t i=0; i<width; ++i)
+            {
+                size_t d = i / bytes_per_digit;
+                out[width-1-i] = d < digit_size ? uint8_t(digit_list[d] >> (8 * (i % bytes_per_digit))) : 0;
+            }
+            return (bit_length() + 7) / 8 <= width;
+        } else {
+            Integer t(*this);
+            for (size_t i=width; i-- > 0;) out[i] = uint8_t(t._div_small(256));
+            return t.digit_size == 1 && t.digit_list[0] == 0;
+        }
+    }
 
-        auto res4 = b.multiply_fast(d);
-//        std::cout<<"res4: bd = "<<b.to_string()<<" x "<<d.to_string()<<" = "<<res4.to_string()<<std::endl;
+    // this = the non-negative value of a big-endian byte string.
+    // Returns false, leaving this 0, if the value doesn't fit the storage.
+    bool from_bytes(const uint8_t *in, size_t size)
+    {
+        // leading zero bytes don't take any room
+        while (size > 0 && in[0] == 0) {
+            in += 1;
+            size -= 1;
+        }
+        if constexpr (Traits::binary) {
+            const size_t bytes_per_digit = Traits::bits / 8;
+            size_t n = std::max<size_t>(1, (size + bytes_per_digit - 1) / bytes_per_digit);
+            if (n > Storage<DIGIT_NUM, ElementType>::max_digits) {
+                from_digits(nullptr, 0);
+                return false;
+            }
+            _reserve(n);
+            for (size_t d=0; d<n; ++d) digit_list[d] = 0;
+            for (size_t i=0; i<size; ++i)
+            {
+                digit_list[i / bytes_per_digit] |= ElementType(in[size-1-i]) << (8 * (i % bytes_per_digit));
+            }
+            digit_size = n;
+        } else {
+            // every byte adds at most log_base(256) digits
+            if (size_t(size * 8 / std::log2(double(Traits::base))) + 1 > Storage<DIGIT_NUM, ElementType>::max_digits) {
+                from_digits(nullptr, 0);
+                return false;
+            }
+            digit_size = 1;
+            digit_list[0] = 0;
+            for (size_t i=0; i<size; ++i) _mul_add_small(256, in[i]);
+        }
+        sign = 1;
+        _trim();
+        return true;
+    }
 
-        auto res = res1.add(res2).add(res3).add(res4);
-//        std::cout<<"res = "<<res.to_string()<<std::endl;
-//        std::cout<<std::endl;
+    // the digits of |this|, least significant first, get_digit_size() of them
+    const ElementType *digits() const { return digit_list; }
 
-        return res;
+    // this = the non-negative value of n digits, least significant first.
+    // Returns false if they don't fit the storage or one is not a digit of this base.
+    bool from_digits(const ElementType *in, size_t n)
+    {
+        while (n > 0 && in[n-1] == 0) n -= 1;
+        if (n > Storage<DIGIT_NUM, ElementType>::max_digits) return false;
+        if constexpr (!Traits::binary) {
+            for (size_t i=0; i<n; ++i)
+            {
+                if (in[i] < 0 || WideType(in[i]) >= Traits::base) return false;
+            }
+        }
+        _reserve(std::max<size_t>(n, 1));
+        digit_list[0] = 0;
+        for (size_t i=0; i<n; ++i) digit_list[i] = in[i];
+        digit_size = std::max<size_t>(n, 1);
+        sign = n > 0 ? 1 : 0;
+        return true;
     }
 
-    void zerofy()
+    // this = a random number below 2^bits with its bits taken from e, bit bits-1 set when top is
+    // and bit 0 set when odd is. Binary digits are filled with the engine output directly.
+    // Returns false if the number wouldn't fit the storage.
+    template<typename Engine>
+    bool fill_random(size_t bits, Engine &e, bool top = true, bool odd = false)
     {
-        digit_size = 1;
-        digit_list[0] = 0;
-        sign = 0;
+        if (bits == 0) return from_digits(nullptr, 0);
+        if constexpr (Traits::binary) {
+            size_t n = (bits + Traits::bits - 1) / Traits::bits;
+            if (n > Storage<DIGIT_NUM, ElementType>::max_digits) return false;
+            _reserve(n);
+            std::uniform_int_distribution<ElementType> word;
+            for (size_t i=0; i<n; ++i) digit_list[i] = word(e);
+            int top_bits = int(bits - (n-1) * Traits::bits);
+            if (top_bits < Traits::bits) digit_list[n-1] &= (ElementType(1) << top_bits) - 1;
+            if (top) digit_list[n-1] |= ElementType(1) << (top_bits-1);
+            if (odd) digit_list[0] |= 1;
+            digit_size = n;
+            sign = 1;
+            _trim();
+        } else {
+            if (size_t(bits / std::log2(double(Traits::base))) + 1 > Storage<DIGIT_NUM, ElementType>::max_digits) return false;
+            std::vector<uint8_t> bytes((bits + 7) / 8);
+            std::uniform_int_distribution<unsigned> byte(0, 255);
+            for (auto &b : bytes) b = uint8_t(byte(e));
+            int top_bits = int(bits - (bytes.size()-1) * 8);
+            bytes[0] &= uint8_t((1u << top_bits) - 1);
+            if (top) bytes[0] |= uint8_t(1u << (top_bits-1));
+            if (odd) bytes.back() |= 1;
+            from_bytes(bytes.data(), bytes.size());
+        }
+        return true;
     }
 
-    void mod_div(const Integer &b, Integer &mod_res, Integer &div_res) const
+    // -this^-1 mod base, the constant used by montgomery_reduce.
+    // Returns 0 if the lowest digit is not invertible modulo the base.
+    ElementType montgomery_inverse() const
     {
-        const Integer &a = *this;
-        mod_res.zerofy();
-        div_res.zerofy();
-
-        for (size_t i=a.digit_size-1;; --i)
-        {
-            mod_res = mod_res.left_shift(1);
-            mod_res.digit_list[0] = a.digit_list[i];
-            if (mod_res.digit_list[0] != 0) mod_res.sign = 1;
-
-            div_res = div_res.left_shift(1);
-
-            auto cmp = mod_res.compare_abs(b);
-            if (cmp == 0) {
-                div_res.digit_list[0] = 1;
-                div_res.sign = 1;
-                mod_res.zerofy();
-            } else if (cmp < 0) {
-                div_res.digit_list[0] = 0;
-            } else {
-                auto factor = mod_res._find_max_factor_bin(b);
-                Integer f = b.multiply_fast(factor);
-                div_res.digit_list[0] = factor;
-                div_res.sign = 1;
-                mod_res = mod_res.sub_abs(f);
-                if (mod_res.digit_size == 1 && mod_res.digit_list[0] == 0) mod_res.sign = 0;
+        ElementType d = digit_list[0];
+        if constexpr (Traits::binary) {
+            if (d % 2 == 0) return 0;
+            // Newton iteration, every step doubles the number of correct low bits
+            ElementType x = d;
+            for (int i=0; i<5; ++i) x *= ElementType(2) - d * x;
+            return ElementType(0) - x;
+        } else {
+            long long a = d, b = Traits::base, x0 = 1, x1 = 0;
+            while (b)
+            {
+                long long q = a / b, t = a - q * b;
+                a = b; b = t;
+                t = x0 - q * x1;
+                x0 = x1; x1 = t;
             }
-
-            if (i == 0) break;
+            if (a != 1) return 0;
+            long long inv = ((x0 % (long long)Traits::base) + (long long)Traits::base) % (long long)Traits::base;
+            return ElementType(inv == 0 ? 0 : Traits::base - inv);
         }
     }
 
-    Integer mod(const Integer &b) const
+    // Montgomery reduction, this = this * base^-k mod n, where k is the digit size of n
+    // and n_inv = n.montgomery_inverse(). Requires 0 <= this < n * base^k.
+    void montgomery_reduce(const Integer &n, ElementType n_inv)
     {
-        const Integer &a = *this;
-        auto cmp = a.compare_abs(b);
-        if (cmp == 0) return Integer(0);
-        else if (cmp < 0) return a;
+        size_t k = n.digit_size;
+        _reserve(2*k+1);
+        for (size_t i=digit_size; i<2*k+1; ++i) digit_list[i] = 0;
+        _montgomery_reduce_raw(digit_list, n.digit_list, k, n_inv);
+        for (size_t i=0; i<=k; ++i) digit_list[i] = digit_list[i+k];
+        digit_size = k+1;
+        sign = 1;
+        _trim();
+    }
 
-        Integer mod_res, div_res;
-        mod_div(b, mod_res, div_res);
+    // dst = a * b * base^-k mod n, for a, b < n. dst may be one of the operands.
+    static void montgomery_multiply_into(Integer &dst, const Integer &a, const Integer &b, const Integer &n, ElementType n_inv)
+    {
+        size_t k = n.digit_size, pn = a.digit_size + b.digit_size;
+        ElementType *t = _scratch(SCRATCH_PRODUCT, std::max(pn, 2*k) + 1);
+        _mul_raw(a.digit_list, a.digit_size, b.digit_list, b.digit_size, t);
+        for (size_t i=pn; i<2*k+1; ++i) t[i] = 0;
+        _montgomery_reduce_raw(t, n.digit_list, k, n_inv);
+
+        dst.digit_size = 0;
+        dst._reserve(k+1);
+        for (size_t i=0; i<=k; ++i) dst.digit_list[i] = t[i+k];
+        dst.digit_size = k+1;
+        dst.sign = 1;
+        dst._trim();
+    }
 
-        return mod_res;
+    // dst = a * a * base^-k mod n, for a < n. dst may be a.
+    static void montgomery_square_into(Integer &dst, const Integer &a, const Integer &n, ElementType n_inv)
+    {
+        size_t k = n.digit_size, pn = 2*a.digit_size;
+        ElementType *t = _scratch(SCRATCH_PRODUCT, std::max(pn, 2*k) + 1);
+        _sqr_raw(a.digit_list, a.digit_size, t);
+        for (size_t i=pn; i<2*k+1; ++i) t[i] = 0;
+        _montgomery_reduce_raw(t, n.digit_list, k, n_inv);
+
+        dst.digit_size = 0;
+        dst._reserve(k+1);
+        for (size_t i=0; i<=k; ++i) dst.digit_list[i] = t[i+k];
+        dst.digit_size = k+1;
+        dst.sign = 1;
+        dst._trim();
     }
 
-    Integer div(const Integer &b) const
+    Integer montgomery_multiply(const Integer &b, const Integer &n, ElementType n_inv) const
     {
-        const Integer &a = *this;
-        auto cmp = a.compare_abs(b);
-        if (cmp == 0) return Integer(1);
-        else if (cmp < 0) return Integer(0);
+        Integer c;
+        montgomery_multiply_into(c, *this, b, n, n_inv);
+        return c;
+    }
+
+    void mod_div(const Integer &b, Integer &mod_res, Integer &div_res) const
+    {
+        mod_res = *this;
+        mod_res._divmod_in_place(b, &div_res);
+    }
 
-        Integer mod_res, div_res;
-        mod_div(b, mod_res, div_res);
+    Integer mod(const Integer &b) const
+    {
+        Integer c(*this);
+        c %= b;
+        return c;
+    }
 
-        return div_res;
+    Integer div(const Integer &b) const
+    {
+        Integer c(*this);
+        c /= b;
+        return c;
     }
 
     operator long long() const{
@@ -538,83 +1552,317 @@ public:
     }
 };
 
-template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType>
-bool operator== (const Integer<DIGIT_NUM, DIGIT_VAL, ElementType> &a, const Integer<DIGIT_NUM, DIGIT_VAL, ElementType> &b)
+template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType, template<int, typename> class Storage>
+bool operator== (const Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage> &a, const Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage> &b)
 {
     return a.compare(b) == 0;
 }
 
-template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType>
-bool operator!= (const Integer<DIGIT_NUM, DIGIT_VAL, ElementType> &a, const Integer<DIGIT_NUM, DIGIT_VAL, ElementType> &b)
+template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType, template<int, typename> class Storage>
+bool operator!= (const Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage> &a, const Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage> &b)
 {
     return a.compare(b) != 0;
 }
 
-template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType>
-bool operator> (const Integer<DIGIT_NUM, DIGIT_VAL, ElementType> &a, const Integer<DIGIT_NUM, DIGIT_VAL, ElementType> &b)
+template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType, template<int, typename> class Storage>
+bool operator> (const Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage> &a, const Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage> &b)
 {
     return a.compare(b) > 0;
 }
-template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType>
-bool operator>= (const Integer<DIGIT_NUM, DIGIT_VAL, ElementType> &a, const Integer<DIGIT_NUM, DIGIT_VAL, ElementType> &b)
+template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType, template<int, typename> class Storage>
+bool operator>= (const Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage> &a, const Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage> &b)
 {
     return a.compare(b) >= 0;
 }
 
-template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType>
-bool operator<= (const Integer<DIGIT_NUM, DIGIT_VAL, ElementType> &a, const Integer<DIGIT_NUM, DIGIT_VAL, ElementType> &b)
+template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType, template<int, typename> class Storage>
+bool operator<= (const Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage> &a, const Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage> &b)
 {
     return a.compare(b) <= 0;
 }
-template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType>
-bool operator< (const Integer<DIGIT_NUM, DIGIT_VAL, ElementType> &a, const Integer<DIGIT_NUM, DIGIT_VAL, ElementType> &b)
+template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType, template<int, typename> class Storage>
+bool operator< (const Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage> &a, const Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage> &b)
 {
-    return a.compare(b) <= 0;
+    return a.compare(b) < 0;
 }
 
-template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType>
-auto operator+ (const Integer<DIGIT_NUM, DIGIT_VAL, ElementType> &a, const Integer<DIGIT_NUM, DIGIT_VAL, ElementType> &b)
+template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType, template<int, typename> class Storage>
+auto operator+ (Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage> a, const Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage> &b)
 {
-    return a.add(b);
+    a += b;
+    return a;
 }
 
-template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType>
-auto operator- (const Integer<DIGIT_NUM, DIGIT_VAL, ElementType> &a, const Integer<DIGIT_NUM, DIGIT_VAL, ElementType> &b)
+template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType, template<int, typename> class Storage>
+auto operator- (Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage> a, const Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage> &b)
 {
-    return a.sub(b);
+    a -= b;
+    return a;
 }
 
-template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType>
-auto operator* (const Integer<DIGIT_NUM, DIGIT_VAL, ElementType> &a, const Integer<DIGIT_NUM, DIGIT_VAL, ElementType> &b)
+template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType, template<int, typename> class Storage>
+auto operator* (const Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage> &a, const Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage> &b)
 {
-    return a.multiply(b);
+    return a.multiply_fast(b);
 }
 
-template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType>
-auto operator/ (const Integer<DIGIT_NUM, DIGIT_VAL, ElementType> &a, const Integer<DIGIT_NUM, DIGIT_VAL, ElementType> &b)
+template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType, template<int, typename> class Storage>
+auto operator/ (Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage> a, const Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage> &b)
 {
-    return a.div(b);
+    a /= b;
+    return a;
 }
 
-template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType>
-auto operator% (const Integer<DIGIT_NUM, DIGIT_VAL, ElementType> &a, const Integer<DIGIT_NUM, DIGIT_VAL, ElementType> &b)
+template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType, template<int, typename> class Storage>
+auto operator% (Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage> a, const Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage> &b)
 {
-    return a.mod(b);
+    a %= b;
+    return a;
 }
 
-template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType>
-std::ostream &operator<<(std::ostream &out, const Integer<DIGIT_NUM, DIGIT_VAL, ElementType> &a)
+template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType, template<int, typename> class Storage>
+std::ostream &operator<<(std::ostream &out, const Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage> &a)
 {
     return out<<a.to_string();
 }
 
-template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType>
-std::istream &operator>>(std::istream &in, Integer<DIGIT_NUM, DIGIT_VAL, ElementType> &a)
+template<int DIGIT_NUM, int DIGIT_VAL, typename ElementType, template<int, typename> class Storage>
+std::istream &operator>>(std::istream &in, Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage> &a)
 {
     std::string s;
     in>>s;
-    a = Integer<DIGIT_NUM, DIGIT_VAL, ElementType>(s);
+    a = Integer<DIGIT_NUM, DIGIT_VAL, ElementType, Storage>(s);
     return in;
 }
 
+// binary radix backends, sized to hold the same magnitudes as Integer<>
+using Integer32 = Integer<856, 0, uint32_t>;
+#ifdef __SIZEOF_INT128__
+using Integer64 = Integer<432, 0, uint64_t>;
+#endif
+
+// variable length binary backends, values up to 512 bits stay inline
+using VarInteger32 = Integer<16, 0, uint32_t, SmallDigitStorage>;
+#ifdef __SIZEOF_INT128__
+using VarInteger64 = Integer<8, 0, uint64_t, SmallDigitStorage>;
+#endif
+
+#ifdef __SIZEOF_INT128__
+// Arithmetic on numbers of exactly L 64 bit limbs, least significant first. L is a compile time
+// constant, so every loop has a fixed trip count the compiler can unroll and all temporaries
+// sit on the stack, there is no digit count to track, no trimming and no scratch lookup.
+template<size_t L>
+struct FixedLimbs
+{
+    using Limbs = std::array<uint64_t, L>;
+    using Wide = unsigned __int128;
+    static constexpr size_t karatsuba_threshold = INTEGER_KARATSUBA_THRESHOLD < 4 ? 4 : INTEGER_KARATSUBA_THRESHOLD;
+
+    // r = a + b, returns the carry. r may be a or b.
+    static uint64_t add(uint64_t *r, const uint64_t *a, const uint64_t *b)
+    {
+        uint64_t carry = 0;
+        for (size_t i=0; i<L; ++i)
+        {
+            Wide x = Wide(a[i]) + b[i] + carry;
+            r[i] = uint64_t(x);
+            carry = uint64_t(x >> 64);
+        }
+        return carry;
+    }
+
+    // r = a - b, returns the borrow. r may be a or b.
+    static uint64_t sub(uint64_t *r, const uint64_t *a, const uint64_t *b)
+    {
+        uint64_t borrow = 0;
+        for (size_t i=0; i<L; ++i)
+        {
+            Wide x = Wide(a[i]) - b[i] - borrow;
+            r[i] = uint64_t(x);
+            borrow = uint64_t(x >> 64) & 1;
+        }
+        return borrow;
+    }
+
+    // r[0, 2L) = a * b, r must not overlap a or b
+    static void mul(uint64_t *r, const uint64_t *a, const uint64_t *b)
+    {
+        if constexpr (L >= karatsuba_threshold && L % 2 == 1) {
+            // one more limb, so that Karatsuba splits it evenly
+            uint64_t a1[L+1], b1[L+1], r1[2*L+2];
+            std::copy(a, a+L, a1);
+            std::copy(b, b+L, b1);
+            a1[L] = b1[L] = 0;
+            FixedLimbs<L+1>::mul(r1, a1, b1);
+            std::copy(r1, r1+2*L, r);
+        } else if constexpr (L >= karatsuba_threshold) {
+            // (a0 - a1) * (b1 - b0) = a0*b1 + a1*b0 - a0*b0 - a1*b1, no carries in the factors
+            constexpr size_t h = L/2;
+            uint64_t da[h], db[h], t[L];
+            bool neg = FixedLimbs<h>::_abs_diff(da, a, a+h) != FixedLimbs<h>::_abs_diff(db, b+h, b);
+            FixedLimbs<h>::mul(r, a, b);
+            FixedLimbs<h>::mul(r+L, a+h, b+h);
+            FixedLimbs<h>::mul(t, da, db);
+            _add_middle(r, t, neg);
+        } else {
+            for (size_t i=0; i<2*L; ++i) r[i] = 0;
+            for (size_t i=0; i<L; ++i)
+            {
+                uint64_t carry = 0;
+                for (size_t j=0; j<L; ++j)
+                {
+                    Wide x = Wide(a[i]) * b[j] + r[i+j] + carry;
+                    r[i+j] = uint64_t(x);
+                    carry = uint64_t(x >> 64);
+                }
+                r[i+L] = carry;
+            }
+        }
+    }
+
+    // r[0, 2L) = a * a, r must not overlap a
+    static void sqr(uint64_t *r, const uint64_t *a)
+    {
+        if constexpr (L >= karatsuba_threshold && L % 2 == 1) {
+            uint64_t a1[L+1], r1[2*L+2];
+            std::copy(a, a+L, a1);
+            a1[L] = 0;
+            FixedLimbs<L+1>::sqr(r1, a1);
+            std::copy(r1, r1+2*L, r);
+        } else if constexpr (L >= karatsuba_threshold) {
+            constexpr size_t h = L/2;
+            uint64_t d[h], t[L];
+            FixedLimbs<h>::_abs_diff(d, a, a+h);
+            FixedLimbs<h>::sqr(r, a);
+            FixedLimbs<h>::sqr(r+L, a+h);
+            FixedLimbs<h>::sqr(t, d);
+            _add_middle(r, t, true);
+        } else {
+            // the products below the diagonal once, doubled, then the squares on it
+            for (size_t i=0; i<2*L; ++i) r[i] = 0;
+            for (size_t i=0; i<L; ++i)
+            {
+                uint64_t carry = 0;
+                for (size_t j=i+1; j<L; ++j)
+                {
+                    Wide x = Wide(a[i]) * a[j] + r[i+j] + carry;
+                    r[i+j] = uint64_t(x);
+                    carry = uint64_t(x >> 64);
+                }
+                r[i+L] = carry;
+            }
+            uint64_t top = 0;
+            for (size_t i=0; i<2*L; ++i)
+            {
+                uint64_t x = r[i];
+                r[i] = (x << 1) | top;
+                top = x >> 63;
+            }
+            uint64_t carry = 0;
+            for (size_t i=0; i<L; ++i)
+            {
+                Wide x = Wide(a[i]) * a[i];
+                Wide y = Wide(r[2*i]) + uint64_t(x) + carry;
+                r[2*i] = uint64_t(y);
+                y = Wide(r[2*i+1]) + uint64_t(x >> 64) + uint64_t(y >> 64);
+                r[2*i+1] = uint64_t(y);
+                carry = uint64_t(y >> 64);
+            }
+        }
+    }
+
+    // r = t * 2^(-64L) mod n, fully reduced, for t[0, 2L) < n * 2^(64L) and n_inv = -n^-1 mod 2^64.
+    // t is used up.
+    static void montgomery_reduce(uint64_t *r, uint64_t *t, const uint64_t *n, uint64_t n_inv)
+    {
+        uint64_t top = 0; // carry out of t[2L-1]
+        for (size_t i=0; i<L; ++i)
+        {
+            uint64_t m = t[i] * n_inv;
+            uint64_t carry = 0;
+            for (size_t j=0; j<L; ++j)
+            {
+                Wide x = Wide(m) * n[j] + t[i+j] + carry;
+                t[i+j] = uint64_t(x);
+                carry = uint64_t(x >> 64);
+            }
+            Wide x = Wide(t[i+L]) + carry + top;
+            t[i+L] = uint64_t(x);
+            top = uint64_t(x >> 64);
+        }
+        // the result is below 2n
+        uint64_t d[L];
+        bool ge = sub(d, t+L, n) == 0 || top;
+        for (size_t i=0; i<L; ++i) r[i] = ge ? d[i] : t[i+L];
+    }
+
+    // r = a * b * 2^(-64L) mod n for a, b < n, r may be a or b
+    static void montgomery_multiply(uint64_t *r, const uint64_t *a, const uint64_t *b, const uint64_t *n, uint64_t n_inv)
+    {
+        uint64_t t[2*L];
+        mul(t, a, b);
+        montgomery_reduce(r, t, n, n_inv);
+    }
+
+    // r = a * a * 2^(-64L) mod n for a < n, r may be a
+    static void montgomery_square(uint64_t *r, const uint64_t *a, const uint64_t *n, uint64_t n_inv)
+    {
+        uint64_t t[2*L];
+        sqr(t, a);
+        montgomery_reduce(r, t, n, n_inv);
+    }
+
+    // r = |a - b|, true if a < b
+    static bool _abs_diff(uint64_t *r, const uint64_t *a, const uint64_t *b)
+    {
+        if (sub(r, a, b) == 0) return false;
+        sub(r, b, a);
+        return true;
+    }
+
+    // the middle term of the Karatsuba products in r[0, 4 * L/2): r += (r_low + r_high +- t) * 2^(64 L/2)
+    static void _add_middle(uint64_t *r, const uint64_t *t, bool neg)
+    {
+        constexpr size_t h = L/2;
+        uint64_t m[L];
+        uint64_t top = add(m, r, r+L);
+        if (neg) top -= sub(m, m, t);
+        else top += add(m, m, t);
+        top += add(r+h, r+h, m);
+        for (size_t i=h+L; top; ++i)
+        {
+            Wide x = Wide(r[i]) + top;
+            r[i] = uint64_t(x);
+            top = uint64_t(x >> 64);
+        }
+    }
+};
+
+// Digits of a FixedInt, a FixedDigitStorage of its own type so that fixed_int_limbs can tell
+// FixedInt from the other fixed size backends.
+template<int DIGIT_NUM, typename ElementType>
+class FixedWidthStorage : public FixedDigitStorage<DIGIT_NUM, ElementType>
+{
+};
+
+// 64 bit digits of the moduli a fixed width backend for keys of bits bits takes: the limbs of
+// bits and one more, as keys made for a number of decimal digits straddle the limb boundary
+constexpr size_t fixed_int_limbs_of(size_t bits) { return (bits + 63) / 64; }
+
+// 64 bit digits that a fixed width backend needs: twice the largest modulus for products of
+// two residues and the reduction constants, plus a few for carries
+constexpr size_t fixed_int_digits(size_t bits) { return 2 * (fixed_int_limbs_of(bits) + 1) + 4; }
+
+// fixed width backends for keys of one size, e.g. FixedInt<2048>, every value sits inside
+// the Integer and Montgomery exponentiation modulo such a key or its primes runs on FixedLimbs
+template<size_t BITS>
+using FixedInt = Integer<int(fixed_int_digits(BITS)), 0, uint64_t, FixedWidthStorage>;
+
+// fixed_int_limbs_of the bits a FixedInt is made for, 0 for every other Integer
+template<typename T>
+constexpr size_t fixed_int_limbs = 0;
+template<int DIGIT_NUM>
+constexpr size_t fixed_int_limbs<Integer<DIGIT_NUM, 0, uint64_t, FixedWidthStorage>> = (size_t(DIGIT_NUM) - 6) / 2;
+#endif
+
 #endif //RSA_TOOL_INTEGER_H
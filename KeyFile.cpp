@@ -0,0 +1,181 @@
+#include "KeyFile.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+const uint8_t KEY_FILE_MAGIC[4] = {0xFF, 'R', 'K', 'F'};
+
+static void put_le(std::vector<uint8_t> &out, uint64_t x, size_t bytes)
+{
+    for (size_t i=0; i<bytes; ++i) out.push_back(uint8_t(x >> (8*i)));
+}
+
+static uint64_t get_le(const uint8_t *in, size_t bytes)
+{
+    uint64_t x = 0;
+    for (size_t i=0; i<bytes; ++i) x |= uint64_t(in[i]) << (8*i);
+    return x;
+}
+
+uint64_t fnv1a_64(const uint8_t *data, size_t size)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i=0; i<size; ++i)
+    {
+        h ^= data[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+bool is_key_file(const std::string &path)
+{
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    char magic[4];
+    if (!in.read(magic, 4)) return false;
+    return std::equal(KEY_FILE_MAGIC, KEY_FILE_MAGIC + 4, reinterpret_cast<const uint8_t*>(magic));
+}
+
+std::vector<uint8_t> key_file_to_bytes(const KeyFileHeader &header, const std::vector<KeyFileField> &fields)
+{
+    std::vector<uint8_t> bytes(KEY_FILE_MAGIC, KEY_FILE_MAGIC + 4);
+    bytes.push_back(KEY_FILE_VERSION);
+    bytes.push_back(header.kind);
+    bytes.push_back(header.digit_bytes);
+    bytes.push_back(header.key_version);
+    put_le(bytes, header.digit_val, 4);
+    put_le(bytes, header.encrypt_byte_val, 4);
+    put_le(bytes, header.fragment_size, 8);
+    put_le(bytes, header.encrypt_fragment_size, 8);
+    put_le(bytes, fields.size(), 4);
+    // the mark goes in the byte order of the digits
+    const uint32_t mark = KEY_FILE_BYTE_ORDER;
+    const uint8_t *m = reinterpret_cast<const uint8_t*>(&mark);
+    bytes.insert(bytes.end(), m, m + 4);
+
+    size_t offset = KEY_FILE_HEADER_SIZE + 16 * fields.size();
+    for (auto &f : fields)
+    {
+        put_le(bytes, offset, 8);
+        put_le(bytes, f.digit_num, 8);
+        offset += (f.digit_num * header.digit_bytes + 7) / 8 * 8;
+    }
+    for (auto &f : fields)
+    {
+        size_t n = f.digit_num * header.digit_bytes;
+        bytes.insert(bytes.end(), f.data, f.data + n);
+        bytes.resize((bytes.size() + 7) / 8 * 8, 0);
+    }
+    put_le(bytes, fnv1a_64(bytes.data(), bytes.size()), 8);
+    return bytes;
+}
+
+bool key_file_from_bytes(const uint8_t *data, size_t size, KeyFileHeader &header, std::vector<KeyFileField> &fields)
+{
+    if (size < KEY_FILE_HEADER_SIZE + 8 || !std::equal(KEY_FILE_MAGIC, KEY_FILE_MAGIC + 4, data)) {
+        std::cout<<"The key file is too short or not a binary key file."<<std::endl;
+        return false;
+    }
+    if (data[4] != KEY_FILE_VERSION) {
+        std::cout<<"Unknown key file version: "<<int(data[4])<<std::endl;
+        return false;
+    }
+    if (get_le(data + size - 8, 8) != fnv1a_64(data, size - 8)) {
+        std::cout<<"The key file checksum doesn't match, it may be broken."<<std::endl;
+        return false;
+    }
+
+    header.kind = data[5];
+    header.digit_bytes = data[6];
+    header.key_version = data[7];
+    header.digit_val = uint32_t(get_le(data + 8, 4));
+    header.encrypt_byte_val = uint32_t(get_le(data + 12, 4));
+    header.fragment_size = get_le(data + 16, 8);
+    header.encrypt_fragment_size = get_le(data + 24, 8);
+    size_t field_num = size_t(get_le(data + 32, 4));
+    header.little_endian = get_le(data + 36, 4) == KEY_FILE_BYTE_ORDER;
+
+    const size_t end = size - 8;
+    bool ok = (header.digit_bytes == 1 || header.digit_bytes == 2 || header.digit_bytes == 4 || header.digit_bytes == 8)
+        && field_num <= (end - KEY_FILE_HEADER_SIZE) / 16;
+    // files of later versions may have more fields, the missing ones are zero
+    fields.assign(std::max(field_num, KEY_FIELD_NUM), KeyFileField());
+    for (size_t i=0; ok && i<field_num; ++i)
+    {
+        uint64_t offset = get_le(data + KEY_FILE_HEADER_SIZE + 16*i, 8);
+        uint64_t digit_num = get_le(data + KEY_FILE_HEADER_SIZE + 16*i + 8, 8);
+        ok = offset % 8 == 0 && offset <= end && digit_num <= (end - offset) / header.digit_bytes;
+        fields[i] = {data + offset, size_t(digit_num)};
+    }
+    if (!ok) {
+        std::cout<<"The key file layout is invalid, it may be broken."<<std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool write_key_file(const std::string &path, const std::vector<uint8_t> &bytes)
+{
+    std::ofstream out(path, std::ios::out | std::ios::binary);
+    out.write(reinterpret_cast<const char*>(bytes.data()), std::streamsize(bytes.size()));
+    out.close();
+    if (!out) {
+        std::cout<<"Can\'t write key file: "<<path<<std::endl;
+        return false;
+    }
+    return true;
+}
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string &path)
+{
+    std::ifstream in(path, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!in) {
+        std::cout<<"Can\'t open key file: "<<path<<std::endl;
+        return;
+    }
+    buffer.resize(size_t(in.tellg()));
+    in.seekg(0);
+    in.read(reinterpret_cast<char*>(buffer.data()), std::streamsize(buffer.size()));
+    bytes = buffer.data();
+    length = buffer.size();
+    opened = bool(in);
+}
+
+MappedFile::~MappedFile() {}
+#else
+MappedFile::MappedFile(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        std::cout<<"Can\'t open key file: "<<path<<std::endl;
+        return;
+    }
+    length = size_t(st.st_size);
+    // an empty file can't be mapped, it is just empty
+    void *p = length > 0 ? mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+    close(fd);
+    if (p == MAP_FAILED) {
+        std::cout<<"Can\'t map key file: "<<path<<std::endl;
+        length = 0;
+        return;
+    }
+    bytes = static_cast<const uint8_t*>(p);
+    opened = true;
+}
+
+MappedFile::~MappedFile()
+{
+    if (bytes) munmap(const_cast<uint8_t*>(bytes), length);
+}
+#endif
@@ -0,0 +1,279 @@
+#ifndef RSA_TOOL_KEYFILE_H
+#define RSA_TOOL_KEYFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "RSA.h"
+
+// Binary key files hold a key as raw digits, together with the reduction constants of its
+// moduli, so that loading one takes a single mapping and a few copies instead of parsing.
+// Header numbers are little endian, the digits keep the byte order of the machine that wrote
+// them and the header says which one that was.
+//
+//    0  KEY_FILE_MAGIC                          4 bytes
+//    4  format version, KEY_FILE_VERSION        1 byte
+//    5  KEY_FILE_PUBLIC or KEY_FILE_SECRETE     1 byte
+//    6  bytes of one digit                      1 byte
+//    7  key version, KEY_VERSION_*              1 byte
+//    8  digit base, 0 for binary digits         4 bytes
+//   12  encrypt_byte_val                        4 bytes
+//   16  fragment_size                           8 bytes
+//   24  encrypt_fragment_size                   8 bytes
+//   32  field number                            4 bytes
+//   36  KEY_FILE_BYTE_ORDER, in digit order     4 bytes
+//   40  field table, (offset, digit number)     16 bytes per field
+//       digits of the fields, least significant first, each field at a multiple of 8
+//  end  FNV-1a 64 of all bytes before it        8 bytes
+//
+// A field with no digits is zero, a group of constants with no n_inv digit is not known.
+extern const uint8_t KEY_FILE_MAGIC[4];
+const uint8_t KEY_FILE_VERSION = 1;
+const uint8_t KEY_FILE_PUBLIC = 1;
+const uint8_t KEY_FILE_SECRETE = 2;
+const uint32_t KEY_FILE_BYTE_ORDER = 0x01020304;
+const size_t KEY_FILE_HEADER_SIZE = 40;
+
+// field ids, the exponent is e in public key files and d in secrete ones
+const size_t KEY_FIELD_N = 0;
+const size_t KEY_FIELD_EXPONENT = 1;
+const size_t KEY_FIELD_P = 2;
+const size_t KEY_FIELD_Q = 3;
+const size_t KEY_FIELD_DP = 4;
+const size_t KEY_FIELD_DQ = 5;
+const size_t KEY_FIELD_QINV = 6;
+// ModulusConstants of n, p and q, KEY_CONST_FIELD_NUM fields each: n_inv, r_mod, r2_mod, mu
+const size_t KEY_FIELD_N_CONST = 7;
+const size_t KEY_FIELD_P_CONST = 11;
+const size_t KEY_FIELD_Q_CONST = 15;
+const size_t KEY_CONST_FIELD_NUM = 4;
+const size_t KEY_FIELD_NUM = 19;
+
+struct KeyFileHeader
+{
+    uint8_t kind;
+    uint8_t digit_bytes;
+    uint8_t key_version;
+    uint32_t digit_val;
+    uint32_t encrypt_byte_val;
+    uint64_t fragment_size;
+    uint64_t encrypt_fragment_size;
+    bool little_endian = true; // byte order of the digits
+};
+
+// the digits of one field as they are in the file
+struct KeyFileField
+{
+    const uint8_t *data = nullptr;
+    size_t digit_num = 0;
+};
+
+uint64_t fnv1a_64(const uint8_t *data, size_t size);
+
+// true if the file starts with KEY_FILE_MAGIC, text key files never do
+bool is_key_file(const std::string &path);
+
+// Lays out a whole key file, fields[i] being the field with id i.
+std::vector<uint8_t> key_file_to_bytes(const KeyFileHeader &header, const std::vector<KeyFileField> &fields);
+
+// Checks the layout and the checksum of a key file, fields then point into data.
+// False with a message if it is broken.
+bool key_file_from_bytes(const uint8_t *data, size_t size, KeyFileHeader &header, std::vector<KeyFileField> &fields);
+
+// Read-only view of a whole file. POSIX systems map it, elsewhere it is read into memory.
+class MappedFile
+{
+    const uint8_t *bytes = nullptr;
+    size_t length = 0;
+    bool opened = false;
+#ifdef _WIN32
+    std::vector<uint8_t> buffer;
+#endif
+public:
+    explicit MappedFile(const std::string &path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool is_open() const { return opened; }
+    const uint8_t *data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+bool write_key_file(const std::string &path, const std::vector<uint8_t> &bytes);
+
+// true if the digits of the file are the ones of T, in this machine's byte order
+template<typename T>
+bool is_native_key_file(const KeyFileHeader &header)
+{
+    const uint32_t mark = KEY_FILE_BYTE_ORDER;
+    const bool little = *reinterpret_cast<const uint8_t*>(&mark) == 0x04;
+    return header.digit_bytes == sizeof(typename T::DigitType) && header.digit_val == uint32_t(T::digit_val)
+        && header.little_endian == little;
+}
+
+template<typename T>
+KeyFileField key_file_field(const T &x)
+{
+    return {reinterpret_cast<const uint8_t*>(x.digits()), x == T(0) ? 0 : x.get_digit_size()};
+}
+
+template<typename T>
+void put_modulus_constants(const ModulusConstants<T> &c, size_t id, std::vector<KeyFileField> &fields)
+{
+    if (!c.known) return;
+    fields[id] = {reinterpret_cast<const uint8_t*>(&c.n_inv), 1};
+    fields[id+1] = key_file_field(c.r_mod);
+    fields[id+2] = key_file_field(c.r2_mod);
+    fields[id+3] = key_file_field(c.mu);
+}
+
+template<typename T>
+KeyFileHeader key_file_header(const RSAKey<T> &key, uint8_t kind)
+{
+    const uint32_t mark = KEY_FILE_BYTE_ORDER;
+    KeyFileHeader header;
+    header.kind = kind;
+    header.digit_bytes = uint8_t(sizeof(typename T::DigitType));
+    header.key_version = uint8_t(key.version);
+    header.digit_val = uint32_t(T::digit_val);
+    header.encrypt_byte_val = uint32_t(key.encrypt_byte_val);
+    header.fragment_size = key.fragment_size;
+    header.encrypt_fragment_size = key.encrypt_fragment_size;
+    header.little_endian = *reinterpret_cast<const uint8_t*>(&mark) == 0x04;
+    return header;
+}
+
+// Constants that the key doesn't carry yet are computed before writing.
+template<typename T>
+bool save_key_file(const std::string &path, const PublicKey<T> &pk)
+{
+    ModulusConstants<T> n_const = pk.n_const.known ? pk.n_const : modulus_constants(pk.n);
+    std::vector<KeyFileField> fields(KEY_FIELD_NUM);
+    fields[KEY_FIELD_N] = key_file_field(pk.n);
+    fields[KEY_FIELD_EXPONENT] = key_file_field(pk.e);
+    put_modulus_constants(n_const, KEY_FIELD_N_CONST, fields);
+    return write_key_file(path, key_file_to_bytes(key_file_header(pk, KEY_FILE_PUBLIC), fields));
+}
+
+template<typename T>
+bool save_key_file(const std::string &path, const SecreteKey<T> &sk)
+{
+    ModulusConstants<T> n_const = sk.n_const.known ? sk.n_const : modulus_constants(sk.n);
+    ModulusConstants<T> p_const = sk.p_const.known ? sk.p_const : modulus_constants(sk.p);
+    ModulusConstants<T> q_const = sk.q_const.known ? sk.q_const : modulus_constants(sk.q);
+    std::vector<KeyFileField> fields(KEY_FIELD_NUM);
+    fields[KEY_FIELD_N] = key_file_field(sk.n);
+    fields[KEY_FIELD_EXPONENT] = key_file_field(sk.d);
+    fields[KEY_FIELD_P] = key_file_field(sk.p);
+    fields[KEY_FIELD_Q] = key_file_field(sk.q);
+    fields[KEY_FIELD_DP] = key_file_field(sk.dP);
+    fields[KEY_FIELD_DQ] = key_file_field(sk.dQ);
+    fields[KEY_FIELD_QINV] = key_file_field(sk.qInv);
+    put_modulus_constants(n_const, KEY_FIELD_N_CONST, fields);
+    put_modulus_constants(p_const, KEY_FIELD_P_CONST, fields);
+    put_modulus_constants(q_const, KEY_FIELD_Q_CONST, fields);
+    return write_key_file(path, key_file_to_bytes(key_file_header(sk, KEY_FILE_SECRETE), fields));
+}
+
+// Digits of a file written with another binary digit layout go through bytes,
+// digits of another decimal base can't be read.
+template<typename T>
+bool get_key_file_field(const KeyFileHeader &header, const KeyFileField &f, T &x)
+{
+    if (is_native_key_file<T>(header)) {
+        return x.from_digits(reinterpret_cast<const typename T::DigitType*>(f.data), f.digit_num);
+    }
+    if (header.digit_val != 0 || T::digit_val != 0) return false;
+
+    const size_t n = f.digit_num * header.digit_bytes;
+    std::vector<uint8_t> bytes(n);
+    for (size_t i=0; i<f.digit_num; ++i)
+    {
+        for (size_t j=0; j<header.digit_bytes; ++j)
+        {
+            // byte j of digit i counting from the least significant one
+            uint8_t b = f.data[i * header.digit_bytes + (header.little_endian ? j : header.digit_bytes-1-j)];
+            bytes[n-1 - (i * header.digit_bytes + j)] = b;
+        }
+    }
+    return x.from_bytes(bytes.data(), n);
+}
+
+// The constants are only taken from files with the digits of T, they depend on the digit base.
+template<typename T>
+bool get_modulus_constants(const KeyFileHeader &header, const std::vector<KeyFileField> &fields, size_t id, ModulusConstants<T> &c)
+{
+    c = ModulusConstants<T>();
+    if (!is_native_key_file<T>(header) || fields[id].digit_num != 1) return true;
+    c.n_inv = *reinterpret_cast<const typename T::DigitType*>(fields[id].data);
+    c.known = get_key_file_field(header, fields[id+1], c.r_mod)
+        && get_key_file_field(header, fields[id+2], c.r2_mod)
+        && get_key_file_field(header, fields[id+3], c.mu);
+    return c.known;
+}
+
+template<typename T>
+void get_key_file_header(const KeyFileHeader &header, RSAKey<T> &key)
+{
+    key.fragment_size = size_t(header.fragment_size);
+    key.encrypt_fragment_size = size_t(header.encrypt_fragment_size);
+    key.encrypt_byte_val = int(header.encrypt_byte_val);
+    key.version = header.key_version;
+}
+
+template<typename T>
+bool load_key_file(const std::string &path, PublicKey<T> &pk)
+{
+    MappedFile file(path);
+    KeyFileHeader header;
+    std::vector<KeyFileField> fields;
+    if (!file.is_open() || !key_file_from_bytes(file.data(), file.size(), header, fields)) return false;
+    if (header.kind != KEY_FILE_PUBLIC) {
+        std::cout<<"The key file doesn't hold a public key."<<std::endl;
+        return false;
+    }
+
+    get_key_file_header(header, pk);
+    if (!get_key_file_field(header, fields[KEY_FIELD_N], pk.n)
+        || !get_key_file_field(header, fields[KEY_FIELD_EXPONENT], pk.e)
+        || !get_modulus_constants(header, fields, KEY_FIELD_N_CONST, pk.n_const)) {
+        std::cout<<"The key file doesn't fit this build's integers."<<std::endl;
+        return false;
+    }
+    return true;
+}
+
+template<typename T>
+bool load_key_file(const std::string &path, SecreteKey<T> &sk)
+{
+    MappedFile file(path);
+    KeyFileHeader header;
+    std::vector<KeyFileField> fields;
+    if (!file.is_open() || !key_file_from_bytes(file.data(), file.size(), header, fields)) return false;
+    if (header.kind != KEY_FILE_SECRETE) {
+        std::cout<<"The key file doesn't hold a secrete key."<<std::endl;
+        return false;
+    }
+
+    get_key_file_header(header, sk);
+    if (!get_key_file_field(header, fields[KEY_FIELD_N], sk.n)
+        || !get_key_file_field(header, fields[KEY_FIELD_EXPONENT], sk.d)
+        || !get_key_file_field(header, fields[KEY_FIELD_P], sk.p)
+        || !get_key_file_field(header, fields[KEY_FIELD_Q], sk.q)
+        || !get_key_file_field(header, fields[KEY_FIELD_DP], sk.dP)
+        || !get_key_file_field(header, fields[KEY_FIELD_DQ], sk.dQ)
+        || !get_key_file_field(header, fields[KEY_FIELD_QINV], sk.qInv)
+        || !get_modulus_constants(header, fields, KEY_FIELD_N_CONST, sk.n_const)
+        || !get_modulus_constants(header, fields, KEY_FIELD_P_CONST, sk.p_const)
+        || !get_modulus_constants(header, fields, KEY_FIELD_Q_CONST, sk.q_const)) {
+        std::cout<<"The key file doesn't fit this build's integers."<<std::endl;
+        return false;
+    }
+    return true;
+}
+
+#endif //RSA_TOOL_KEYFILE_H
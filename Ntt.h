@@ -0,0 +1,194 @@
+#ifndef RSA_TOOL_NTT_H
+#define RSA_TOOL_NTT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <utility>
+
+// Number theoretic transform over Z/P for a prime P = c * 2^k + 1 < 2^30 with primitive root G.
+// The butterflies multiply by the roots with Shoup's method (a precomputed w * 2^32 / P per
+// root) and reduce lazily, values stay below 4P < 2^32 and are only reduced in the last pass.
+template<uint32_t P, uint32_t G>
+struct NttPrime
+{
+    static constexpr uint32_t mod = P;
+
+    static uint32_t mul(uint32_t a, uint32_t b) { return uint32_t(uint64_t(a) * b % P); }
+
+    static uint32_t pow(uint32_t a, uint64_t e)
+    {
+        uint32_t res = 1;
+        for (; e; e >>= 1, a = mul(a, a))
+        {
+            if (e & 1) res = mul(res, a);
+        }
+        return res;
+    }
+
+    // a * w mod P up to one P, a < 2^32, w_shoup = w * 2^32 / P
+    static uint32_t mul_shoup(uint32_t a, uint32_t w, uint32_t w_shoup)
+    {
+        uint32_t q = uint32_t((uint64_t(a) * w_shoup) >> 32);
+        return a * w - q * P;
+    }
+
+    struct Roots
+    {
+        std::vector<uint32_t> w, w_shoup;
+    };
+
+    // w[half + j] = r^j, r a primitive (2*half)-th root of unity (its inverse for the
+    // inverse transform), for every power of two half < n
+    static const Roots &roots(size_t n, bool inverse)
+    {
+        thread_local Roots table[2];
+        Roots &t = table[inverse];
+        if (t.w.size() < n) {
+            t.w.assign(n, 0);
+            t.w_shoup.assign(n, 0);
+            for (size_t half=1; half<n; half<<=1)
+            {
+                uint32_t r = pow(G, (P-1) / (2*half));
+                if (inverse) r = pow(r, P-2);
+                t.w[half] = 1;
+                for (size_t j=1; j<half; ++j) t.w[half+j] = mul(t.w[half+j-1], r);
+            }
+            for (size_t i=1; i<n; ++i) t.w_shoup[i] = uint32_t((uint64_t(t.w[i]) << 32) / P);
+        }
+        return t;
+    }
+
+    // n values below 2P to their transform in bit reversed order, below 2P,
+    // n a power of two dividing P-1
+    static void forward(uint32_t *a, size_t n)
+    {
+        const Roots &r = roots(n, false);
+        for (size_t half=n/2; half>=1; half>>=1)
+        {
+            const uint32_t *w = r.w.data() + half, *ws = r.w_shoup.data() + half;
+            for (size_t i=0; i<n; i+=2*half)
+            {
+                uint32_t *x = a + i, *y = a + i + half;
+                for (size_t j=0; j<half; ++j)
+                {
+                    uint32_t u = x[j], v = y[j];
+                    uint32_t s = u + v;
+                    x[j] = s >= 2*P ? s - 2*P : s;
+                    y[j] = mul_shoup(u - v + 2*P, w[j], ws[j]);
+                }
+            }
+        }
+    }
+
+    // reverse of forward without the division by n, values below 2P in and below 4P out
+    static void inverse(uint32_t *a, size_t n)
+    {
+        const Roots &r = roots(n, true);
+        for (size_t half=1; half<n; half<<=1)
+        {
+            const uint32_t *w = r.w.data() + half, *ws = r.w_shoup.data() + half;
+            for (size_t i=0; i<n; i+=2*half)
+            {
+                uint32_t *x = a + i, *y = a + i + half;
+                for (size_t j=0; j<half; ++j)
+                {
+                    uint32_t u = x[j] >= 2*P ? x[j] - 2*P : x[j];
+                    uint32_t v = mul_shoup(y[j], w[j], ws[j]);
+                    x[j] = u + v;
+                    y[j] = u - v + 2*P;
+                }
+            }
+        }
+    }
+
+    // out[0, n) = the cyclic convolution of a and b mod P, b == nullptr squares a
+    static void convolve(const uint32_t *a, size_t an, const uint32_t *b, size_t bn, size_t n, uint32_t *out)
+    {
+        for (size_t i=0; i<n; ++i) out[i] = i < an ? a[i] % P : 0;
+        forward(out, n);
+        if (b) {
+            std::vector<uint32_t> fb(n);
+            for (size_t i=0; i<n; ++i) fb[i] = i < bn ? b[i] % P : 0;
+            forward(fb.data(), n);
+            for (size_t i=0; i<n; ++i) out[i] = mul(out[i], fb[i]);
+        } else {
+            for (size_t i=0; i<n; ++i) out[i] = mul(out[i], out[i]);
+        }
+        inverse(out, n);
+
+        const uint32_t n_inv = pow(uint32_t(n % P), P-2);
+        const uint32_t n_inv_shoup = uint32_t((uint64_t(n_inv) << 32) / P);
+        for (size_t i=0; i<n; ++i)
+        {
+            uint32_t x = mul_shoup(out[i], n_inv, n_inv_shoup);
+            out[i] = x >= P ? x - P : x;
+        }
+    }
+};
+
+using NttPrime1 = NttPrime<998244353, 3>; // 119 * 2^23 + 1
+using NttPrime2 = NttPrime<167772161, 3>; // 5 * 2^25 + 1
+using NttPrime3 = NttPrime<469762049, 3>; // 7 * 2^26 + 1
+
+// longest product the three primes can transform
+const size_t NTT_MAX_SIZE = size_t(1) << 23;
+
+// Product of two numbers given as digits below base <= 2^32, least significant first.
+// c[0, an+bn) = a * b, b == nullptr squares a (bn is then ignored). Every convolution term
+// is below min(an, bn) * base^2 <= 2^86, which the product of the three primes exceeds,
+// as long as an+bn <= NTT_MAX_SIZE. The terms are recovered by CRT and carried in base.
+inline void ntt_multiply(const uint32_t *a, size_t an, const uint32_t *b, size_t bn, uint64_t base, uint32_t *c)
+{
+    if (!b) bn = an;
+    size_t n = 1;
+    while (n < an+bn-1) n <<= 1;
+    std::vector<uint32_t> r1(n), r2(n), r3(n);
+    NttPrime1::convolve(a, an, b, bn, n, r1.data());
+    NttPrime2::convolve(a, an, b, bn, n, r2.data());
+    NttPrime3::convolve(a, an, b, bn, n, r3.data());
+
+    constexpr uint64_t p1 = NttPrime1::mod, p2 = NttPrime2::mod, p3 = NttPrime3::mod;
+    const uint64_t p1_inv = NttPrime2::pow(uint32_t(p1 % p2), p2-2); // p1^-1 mod p2
+    const uint64_t p12_inv = NttPrime3::pow(uint32_t(p1 * p2 % p3), p3-2); // (p1 p2)^-1 mod p3
+
+    // the running value in three 32 bit words, the term added on top of the carry
+    uint64_t acc[3] = {0, 0, 0};
+    for (size_t i=0; i<an+bn; ++i)
+    {
+        if (i < an+bn-1) {
+            // term = r1 + p1 * (t2 + p2 * t3) with t2 < p2, t3 < p3
+            uint64_t t2 = (r2[i] + p2 - r1[i] % p2) % p2 * p1_inv % p2;
+            uint64_t x = (r1[i] + p1 * t2) % p3;
+            uint64_t t3 = (r3[i] + p3 - x) % p3 * p12_inv % p3;
+            uint64_t y = t2 + p2 * t3;
+            uint64_t lo = p1 * (y & 0xffffffffu) + r1[i], hi = p1 * (y >> 32);
+            acc[0] += lo & 0xffffffffu;
+            acc[1] += (lo >> 32) + (hi & 0xffffffffu);
+            acc[2] += hi >> 32;
+            acc[1] += acc[0] >> 32;
+            acc[0] &= 0xffffffffu;
+            acc[2] += acc[1] >> 32;
+            acc[1] &= 0xffffffffu;
+        }
+
+        if (base == (uint64_t(1) << 32)) {
+            c[i] = uint32_t(acc[0]);
+            acc[0] = acc[1];
+            acc[1] = acc[2];
+            acc[2] = 0;
+            continue;
+        }
+        uint64_t r = 0;
+        for (size_t k=3; k-- > 0;)
+        {
+            uint64_t cur = (r << 32) | acc[k];
+            acc[k] = cur / base;
+            r = cur % base;
+        }
+        c[i] = uint32_t(r);
+    }
+}
+
+#endif //RSA_TOOL_NTT_H
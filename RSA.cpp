@@ -5,6 +5,25 @@
 #include "RSA.h"
 
 const size_t DIGIT_NUM_OF_ONE_BYTE = 3;
+const size_t SMALL_PRIME_NUM = 2048;
+
+const std::vector<uint32_t> &small_primes()
+{
+    static const std::vector<uint32_t> primes = []{
+        // the 2048th prime is 17863
+        const uint32_t limit = 17864;
+        std::vector<bool> composite(limit, false);
+        std::vector<uint32_t> res;
+        for (uint32_t i=2; i<limit && res.size()<SMALL_PRIME_NUM; ++i)
+        {
+            if (composite[i]) continue;
+            res.push_back(i);
+            for (uint32_t j=i*i; j<limit; j+=i) composite[j] = true;
+        }
+        return res;
+    }();
+    return primes;
+}
 
 
 std::vector<uint8_t> string_to_bytes(const std::string &s)
@@ -22,73 +41,116 @@ std::string bytes_to_string(const std::vector<uint8_t> &bytes)
     return ss.str();
 }
 
-const char base64_table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 std::string bytes_to_base64(const std::vector<uint8_t> &bytes)
 {
-    std::stringstream ss;
-    for (size_t i=0; i<bytes.size(); i += 3)
-    {
-        if (i + 2 < bytes.size())
-        {
-            auto a = bytes[i];
-            auto b = bytes[i+1];
-            auto c = bytes[i+2];
-
-            ss.put(base64_table[(a&0xfc)>>2]);
-            ss.put(base64_table[((b&0xf0)>>4) | ((a&0x03)<<4)]);
-            ss.put(base64_table[((c&0xc0)>>6) | ((b&0x0f)<<2)]);
-            ss.put(base64_table[(c&0x3f)]);
-        } else if (i + 1 < bytes.size())
-        {
-            auto a = bytes[i];
-            auto b = bytes[i+1];
-
-            ss.put(base64_table[(a&0xfc)>>2]);
-            ss.put(base64_table[((b&0xf0)>>4) | ((a&0x03)<<4)]);
-            ss.put(base64_table[(b&0x0f)<<2]);
-            ss.put('=');
-        } else {
-            auto a = bytes[i];
-
-            ss.put(base64_table[(a&0xfc)>>2]);
-            ss.put(base64_table[(a&0x03)<<4]);
-            ss.put('=');
-            ss.put('=');
-        }
-    }
-    return ss.str();
+    std::string s(base64_encoded_size(bytes.size()), '\0');
+    base64_encode(bytes.data(), bytes.size(), s.data());
+    return s;
 }
-std::vector<uint8_t> base64_to_bytes(const std::string &s)
+
+bool base64_to_bytes(const std::string &s, std::vector<uint8_t> &bytes)
 {
-    auto _inv_base64_table = [](uint8_t x){
-        if (x == '=') return x;
-        uint8_t index = 0;
-        for (auto &a : base64_table)
-        {
-            if (x == a) return index;
-            index += 1;
+    bytes.resize(base64_decoded_max_size(s.size()));
+    size_t size;
+    bool ok = base64_decode(s.data(), s.size(), bytes.data(), size);
+    bytes.resize(size);
+    return ok;
+}
+
+const uint8_t CIPHER_MAGIC[4] = {0xFF, 'R', 'S', 'A'};
+
+std::vector<uint8_t> cipher_header_to_bytes(const CipherHeader &header)
+{
+    std::vector<uint8_t> bytes(CIPHER_MAGIC, CIPHER_MAGIC + 4);
+    bytes.push_back(header.version);
+    for (size_t i=0; i<8; ++i) bytes.push_back(uint8_t(header.length >> (8*i)));
+    return bytes;
+}
+
+bool cipher_header_from_bytes(const std::vector<uint8_t> &data, CipherHeader &header)
+{
+    if (data.size() < CIPHER_HEADER_SIZE) return false;
+    if (!std::equal(CIPHER_MAGIC, CIPHER_MAGIC + 4, data.begin())) return false;
+    header.version = data[4];
+    if (header.version < CIPHER_VERSION_STREAM || header.version > CIPHER_VERSION_DENSE) return false;
+    header.length = 0;
+    for (size_t i=0; i<8; ++i) header.length |= uint64_t(data[5+i]) << (8*i);
+    return true;
+}
+
+bool ByteReader::fill()
+{
+    buffer.erase(buffer.begin(), buffer.begin() + pos);
+    pos = 0;
+
+    std::vector<char> block(STREAM_BLOCK_SIZE);
+    in.read(block.data(), std::streamsize(block.size()));
+    size_t got = size_t(in.gcount());
+    if (got == 0) {
+        // characters left at the end that don't make a whole quantum
+        if (base64 && !text.empty() && !invalid) {
+            std::cout<<"[ERROR] The base64 input is invalid."<<std::endl;
+            invalid = true;
         }
-        return index;
-    };
+        return false;
+    }
+
+    if (!base64) {
+        buffer.insert(buffer.end(), block.begin(), block.begin() + got);
+        return true;
+    }
 
-    std::vector<uint8_t> res;
-    for (size_t i=0; i<s.size(); i += 4)
+    // decode whole quanta of 4 characters, line breaks are skipped
+    for (size_t i=0; i<got; ++i)
     {
-        if (i+3 < s.size())
-        {
-            uint8_t a = _inv_base64_table(s[i]);
-            uint8_t b = _inv_base64_table(s[i+1]);
-            uint8_t c = _inv_base64_table(s[i+2]);
-            uint8_t d = _inv_base64_table(s[i+3]);
-
-            res.push_back(((a&0x3f)<<2) | ((b&0x30)>>4));
-            if (c != '=') {
-                res.push_back(((b&0x0f)<<4) | ((c&0x3c)>>2));
-                if (d != '=') {
-                    res.push_back(((c&0x03)<<6) | ((d&0x3f)));
-                }
-            }
-        }
+        if (block[i] != '\n' && block[i] != '\r' && block[i] != ' ') text.push_back(block[i]);
+    }
+    size_t whole = in ? text.size() / 4 * 4 : text.size();
+    size_t begin = buffer.size(), size;
+    buffer.resize(begin + base64_decoded_max_size(whole));
+    bool ok = base64_decode(text.data(), whole, buffer.data() + begin, size);
+    buffer.resize(begin + size);
+    text.erase(0, whole);
+    if (!ok) {
+        std::cout<<"[ERROR] The base64 input is invalid."<<std::endl;
+        invalid = true;
+        return false;
     }
-    return res;
-}
\ No newline at end of file
+    return true;
+}
+
+size_t ByteReader::read(std::vector<uint8_t> &out, size_t n)
+{
+    while (buffer.size() - pos < n && fill()) ;
+
+    size_t got = std::min(n, buffer.size() - pos);
+    out.insert(out.end(), buffer.begin() + pos, buffer.begin() + pos + got);
+    pos += got;
+    return got;
+}
+
+void ByteWriter::write(const std::vector<uint8_t> &data)
+{
+    if (!base64) {
+        out.write(reinterpret_cast<const char*>(data.data()), std::streamsize(data.size()));
+        return;
+    }
+
+    pending.insert(pending.end(), data.begin(), data.end());
+    size_t whole = pending.size() / 3 * 3;
+    text.resize(base64_encoded_size(whole));
+    base64_encode(pending.data(), whole, text.data());
+    out.write(text.data(), std::streamsize(text.size()));
+    pending.erase(pending.begin(), pending.begin() + whole);
+}
+
+void ByteWriter::finish()
+{
+    if (base64 && !pending.empty()) {
+        text.resize(base64_encoded_size(pending.size()));
+        base64_encode(pending.data(), pending.size(), text.data());
+        out.write(text.data(), std::streamsize(text.size()));
+    }
+    pending.clear();
+    out.flush();
+}
@@ -6,38 +6,106 @@
 #define RSA_TOOL_RSA_H
 
 #include <iostream>
+#include <cstdint>
 #include <string>
-#include <ctime>
 #include <random>
 #include <vector>
 #include <sstream>
-#include <stack>
+#include <algorithm>
+#include <type_traits>
+#include <thread>
+#include <atomic>
+#include <mutex>
+
+#include "Integer.h"
+#include "ThreadPool.h"
+#include "Base64.h"
+#include "Random.h"
 
 template<typename T>
 void ext_gcd(T a, T b, T &c, T &x, T &y)
 {
-    if (b == T(0))
+    // keeps a = x0*a' + y0*b' and b = x1*a' + y1*b' for the original a', b'
+    T x0(1), y0(0), x1(0), y1(1), q, r, t;
+    while (b != T(0))
     {
-        c = a;
-        x = T(1);
-        y = T(0);
-        return;
+        a.mod_div(b, r, q);
+        a = std::move(b);
+        b = std::move(r);
+
+        T::mul_into(t, q, x1);
+        x0 -= t;
+        swap(x0, x1);
+        T::mul_into(t, q, y1);
+        y0 -= t;
+        swap(y0, y1);
     }
-    T x1, y1;
-    ext_gcd(b, a%b, c, x1, y1);
-    x = y1;
-    y = x1 - (a/b) * y1;
+    c = std::move(a);
+    x = std::move(x0);
+    y = std::move(y0);
 }
 
-template<typename T>
-T mul_with_mod(T a, T b, T c)
+template<typename T2>
+std::vector<uint8_t> exponent_bits(const T2 &pow)
+{
+    if constexpr (std::is_integral_v<T2>) {
+        std::vector<uint8_t> bits;
+        for (auto x = pow; x > 0; x >>= 1) bits.push_back(x & 1);
+        return bits;
+    } else return pow.to_bits();
+}
+
+// width of the sliding window for an exponent of the given bit length
+inline int exponent_window_size(size_t bit_len)
 {
-    T res = T(0);
-    while (b > T(0))
+    if (bit_len > 671) return 6;
+    if (bit_len > 239) return 5;
+    if (bit_len > 79) return 4;
+    if (bit_len > 23) return 3;
+    return 1;
+}
+
+// Left-to-right sliding window exponentiation, mul(dst, a, b) stores the product of two values
+// of the working domain in dst (which may alias a or b), sqr(dst, a) the square of one
+// (dst may alias a) and one is the identity of that domain.
+template<typename T, typename T2, typename Mul, typename Sqr>
+T pow_sliding_window(const T &base, const T2 &pow, const T &one, Mul mul, Sqr sqr)
+{
+    auto bits = exponent_bits(pow);
+    if (bits.empty()) return one;
+
+    int w = exponent_window_size(bits.size());
+    // odd powers base^1, base^3, ..., base^(2^w-1)
+    std::vector<T> table(size_t(1) << (w-1));
+    table[0] = base;
+    if (w > 1) {
+        T base2;
+        sqr(base2, base);
+        for (size_t i=1; i<table.size(); ++i) mul(table[i], table[i-1], base2);
+    }
+
+    T res = one;
+    bool res_is_one = true;
+    long long i = (long long)bits.size() - 1;
+    while (i >= 0)
     {
-        res = (res + (b % T(2) * a) % c) % c;
-        a = a * T(2) % c;
-        b = b / T(2);
+        if (bits[i] == 0) {
+            if (!res_is_one) sqr(res, res);
+            i -= 1;
+            continue;
+        }
+        long long j = std::max(i - w + 1, 0LL);
+        while (bits[j] == 0) j += 1;
+        size_t val = 0;
+        for (long long l=i; l>=j; --l) val = (val << 1) | bits[l];
+        if (res_is_one) {
+            res = table[val >> 1];
+            res_is_one = false;
+        } else {
+            for (long long l=i; l>=j; --l) sqr(res, res);
+            mul(res, res, table[val >> 1]);
+        }
+        i = j - 1;
     }
     return res;
 }
@@ -45,114 +113,721 @@ T mul_with_mod(T a, T b, T c)
 template<typename T, typename T2>
 T pow_fast(T base, T2 pow)
 {
-    T res = T(1);
-    while (pow > T2(0))
+    return pow_sliding_window(base, pow, T(1), [](T &dst, const T &a, const T &b){
+        T::mul_into(dst, a, b);
+    }, [](T &dst, const T &a){
+        T::square_into(dst, a);
+    });
+}
+
+// Reduction constants of one modulus. Computing them takes long divisions,
+// binary key files carry them so that loading a key needs none.
+template<typename T>
+struct ModulusConstants
+{
+    bool known = false; // false until computed or loaded
+    typename T::DigitType n_inv = 0; // -n^-1 mod base, 0 if n is not coprime with the base
+    T r_mod; // R mod n with R = base^k, k the digit number of n
+    T r2_mod; // R^2 mod n
+    T mu; // base^(2k) / n for Barrett reduction, 0 if base^(2k) doesn't fit T
+};
+
+template<typename T>
+ModulusConstants<T> modulus_constants(const T &n)
+{
+    ModulusConstants<T> c;
+    if (n == T(0)) return c;
+    c.known = true;
+    c.n_inv = n.montgomery_inverse();
+    size_t k = n.get_digit_size();
+    T r2 = T(1).left_shift(2*k);
+    if (c.n_inv != 0) {
+        c.r_mod = T(1).left_shift(k) % n;
+        c.r2_mod = r2 % n;
+    }
+    c.mu = r2 / n;
+    return c;
+}
+
+// Keeps the constants of Montgomery multiplication for one modulus,
+// so that a whole exponentiation can run without any long division.
+template<typename T>
+class MontgomeryContext
+{
+    T n;
+    typename T::DigitType n_inv; // -n^-1 mod base
+    T r_mod; // R mod n, the Montgomery form of 1
+    T r2_mod; // R^2 mod n
+public:
+    explicit MontgomeryContext(const T &mod) : n(mod)
     {
-        if (pow % T2(2) == T2(1)) {
-            res = res * base;
+        n_inv = n.montgomery_inverse();
+        if (!is_valid()) return;
+        size_t k = n.get_digit_size();
+        r_mod = T(1).left_shift(k) % n;
+        r2_mod = T(1).left_shift(2*k) % n;
+    }
+
+    // takes the constants from c when they are known, computes them otherwise
+    MontgomeryContext(const T &mod, const ModulusConstants<T> &c) : n(mod)
+    {
+        if (!c.known) {
+            *this = MontgomeryContext(mod);
+            return;
         }
-        pow = pow / T2(2);
-        base = (base * base);
+        n_inv = c.n_inv;
+        r_mod = c.r_mod;
+        r2_mod = c.r2_mod;
     }
-    return res;
+
+    // Montgomery form only exists for a modulus that is coprime with the digit base
+    bool is_valid() const { return n_inv != 0; }
+
+    const T &get_mod() const { return n; }
+    const T &get_one() const { return r_mod; }
+    typename T::DigitType get_n_inv() const { return n_inv; }
+
+    T to_mont(const T &a) const
+    {
+        if (a >= n) return (a % n).montgomery_multiply(r2_mod, n, n_inv);
+        return a.montgomery_multiply(r2_mod, n, n_inv);
+    }
+
+    T from_mont(const T &a) const
+    {
+        T c = a;
+        c.montgomery_reduce(n, n_inv);
+        return c;
+    }
+
+    T multiply(const T &a, const T &b) const
+    {
+        return a.montgomery_multiply(b, n, n_inv);
+    }
+
+    void multiply_into(T &dst, const T &a, const T &b) const
+    {
+        T::montgomery_multiply_into(dst, a, b, n, n_inv);
+    }
+
+    void square_into(T &dst, const T &a) const
+    {
+        T::montgomery_square_into(dst, a, n, n_inv);
+    }
+};
+
+// moduli shorter than this are reduced by long division, which is as fast there
+const size_t BARRETT_MIN_BITS = 1536;
+
+// Barrett reduction for one modulus: x mod n for 0 <= x < base^(2k), k the digit number of n,
+// with two multiplications and no long division. Unlike Montgomery form it takes plain values,
+// which suits reductions mixed into other code. Falls back to % where mu doesn't fit T.
+template<typename T>
+class BarrettReducer
+{
+    T n;
+    T mu; // base^(2k) / n
+    size_t k;
+public:
+    explicit BarrettReducer(const T &mod) : n(mod), k(mod.get_digit_size())
+    {
+        if (n.bit_length() >= BARRETT_MIN_BITS) mu = T(1).left_shift(2*k) / n;
+    }
+
+    // takes mu from c when it is known
+    BarrettReducer(const T &mod, const ModulusConstants<T> &c) : n(mod), k(mod.get_digit_size())
+    {
+        if (n.bit_length() < BARRETT_MIN_BITS) return;
+        if (c.known) mu = c.mu;
+        else mu = T(1).left_shift(2*k) / n;
+    }
+
+    bool is_valid() const { return mu != T(0); }
+
+    const T &get_mod() const { return n; }
+
+    // x = x mod n for x >= 0
+    void reduce(T &x) const
+    {
+        if (!is_valid() || x.get_digit_size() > 2*k) {
+            x %= n;
+            return;
+        }
+        // q = (x / base^(k-1)) * mu / base^(k+1) is at most two below x / n
+        T q;
+        T::mul_into(q, x.right_shift(int(k-1)), mu);
+        q = q.right_shift(int(k+1));
+        T::mul_into(q, q, n);
+        x -= q;
+        while (x >= n) x -= n;
+    }
+
+    // dst = a * b mod n, dst may be one of the operands
+    void multiply_into(T &dst, const T &a, const T &b) const
+    {
+        T::mul_into(dst, a, b);
+        reduce(dst);
+    }
+
+    // dst = a * a mod n, dst may be a
+    void square_into(T &dst, const T &a) const
+    {
+        T::square_into(dst, a);
+        reduce(dst);
+    }
+};
+
+template<typename T, typename T2>
+T pow_fast_with_mod(T base, T2 pow, T mod);
+
+#ifdef __SIZEOF_INT128__
+// pow_fast_with_mod on the FixedLimbs<L> kernels, for a modulus of exactly L digits
+template<size_t L, typename T, typename T2>
+T pow_fixed_limbs(const T &base, const T2 &pow, const MontgomeryContext<T> &ctx)
+{
+    using Limbs = typename FixedLimbs<L>::Limbs;
+    auto limbs = [](const T &x) {
+        Limbs r{};
+        std::copy(x.digits(), x.digits() + x.get_digit_size(), r.begin());
+        return r;
+    };
+    const Limbs n = limbs(ctx.get_mod());
+    const uint64_t n_inv = ctx.get_n_inv();
+
+    Limbs res = pow_sliding_window(limbs(ctx.to_mont(base)), pow, limbs(ctx.get_one()), [&](Limbs &dst, const Limbs &a, const Limbs &b){
+        FixedLimbs<L>::montgomery_multiply(dst.data(), a.data(), b.data(), n.data(), n_inv);
+    }, [&](Limbs &dst, const Limbs &a){
+        FixedLimbs<L>::montgomery_square(dst.data(), a.data(), n.data(), n_inv);
+    });
+    uint64_t t[2*L] = {};
+    std::copy(res.begin(), res.end(), t);
+    FixedLimbs<L>::montgomery_reduce(res.data(), t, n.data(), n_inv);
+    T r;
+    r.from_digits(res.data(), L);
+    return r;
+}
+#endif
+
+template<typename T, typename T2>
+T pow_fast_with_mod(T base, T2 pow, const MontgomeryContext<T> &ctx)
+{
+    if (!ctx.is_valid()) return pow_fast_with_mod(base, pow, ctx.get_mod());
+#ifdef __SIZEOF_INT128__
+    // a FixedInt has kernels for the moduli of its keys, n and the primes p and q of half its
+    // size, each of them may take one limb more
+    constexpr size_t L = fixed_int_limbs<T>;
+    if constexpr (L > 0) {
+        static_assert(L >= 4, "FixedInt is made for keys of 256 bits and more");
+        switch (ctx.get_mod().get_digit_size())
+        {
+        case L: return pow_fixed_limbs<L>(base, pow, ctx);
+        case L+1: return pow_fixed_limbs<L+1>(base, pow, ctx);
+        case (L+1)/2: return pow_fixed_limbs<(L+1)/2>(base, pow, ctx);
+        case (L+1)/2+1: return pow_fixed_limbs<(L+1)/2+1>(base, pow, ctx);
+        }
+    }
+#endif
+
+    T res = pow_sliding_window(ctx.to_mont(base), pow, ctx.get_one(), [&ctx](T &dst, const T &a, const T &b){
+        ctx.multiply_into(dst, a, b);
+    }, [&ctx](T &dst, const T &a){
+        ctx.square_into(dst, a);
+    });
+    return ctx.from_mont(res);
 }
 
 template<typename T, typename T2>
 T pow_fast_with_mod(T base, T2 pow, T mod)
 {
-    T res = T(1);
-    while (pow > T2(0))
+    MontgomeryContext<T> ctx(mod);
+    if (ctx.is_valid()) return pow_fast_with_mod(base, pow, ctx);
+
+    BarrettReducer<T> red(mod);
+    return pow_sliding_window(base % mod, pow, T(1) % mod, [&red](T &dst, const T &a, const T &b){
+        red.multiply_into(dst, a, b);
+    }, [&red](T &dst, const T &a){
+        red.square_into(dst, a);
+    });
+}
+
+// a uniform random number in [0, bound), bound > 0
+template<typename T, typename Engine>
+T random_below(const T &bound, Engine &e)
+{
+    const size_t bits = bound.bit_length();
+    T x;
+    // less than two tries on average
+    do x.fill_random(bits, e, false); while (x >= bound);
+    return x;
+}
+
+// Arithmetic modulo one odd candidate as the primality tests use it, in Montgomery form when
+// the candidate is coprime with the digit base and on plain values with Barrett reduction
+// otherwise. Values are kept in that form, one() and minus_one() included.
+template<typename T>
+class PrimeTestContext
+{
+    MontgomeryContext<T> ctx;
+    BarrettReducer<T> red;
+    bool mont;
+    T one_f, minus_one_f;
+public:
+    explicit PrimeTestContext(const T &p) : ctx(p), red(ctx.is_valid() ? T(0) : p), mont(ctx.is_valid())
+    {
+        one_f = mont ? ctx.get_one() : T(1);
+        minus_one_f = p - one_f;
+    }
+
+    const T &get_mod() const { return ctx.get_mod(); }
+    const T &one() const { return one_f; }
+    const T &minus_one() const { return minus_one_f; }
+
+    // a mod p in the working form, a >= 0
+    T to_form(const T &a) const { return mont ? ctx.to_mont(a) : a % get_mod(); }
+
+    void mul(T &dst, const T &a, const T &b) const
     {
-        if (pow % T2(2) == T2(1)) {
-            res = res * base % mod;
+        if (mont) ctx.multiply_into(dst, a, b);
+        else red.multiply_into(dst, a, b);
+    }
+
+    void sqr(T &dst, const T &a) const
+    {
+        if (mont) ctx.square_into(dst, a);
+        else red.square_into(dst, a);
+    }
+
+    void add(T &dst, const T &a) const
+    {
+        dst += a;
+        if (dst >= get_mod()) dst -= get_mod();
+    }
+
+    void sub(T &dst, const T &a) const
+    {
+        if (dst < a) dst += get_mod();
+        dst -= a;
+    }
+
+    // dst = dst / 2 mod p
+    void half(T &dst) const
+    {
+        if (dst.get_digit_size() > 0 && (dst.digits()[0] & 1)) dst += get_mod();
+        dst = dst / T(2);
+    }
+};
+
+// Strong probable prime test to base a (in the working form) for p - 1 = t * 2^k
+template<typename T>
+bool strong_probable_prime(const PrimeTestContext<T> &pc, const T &a, const T &t, size_t k)
+{
+    T res = pow_sliding_window(a, t, pc.one(), [&pc](T &dst, const T &x, const T &y){
+        pc.mul(dst, x, y);
+    }, [&pc](T &dst, const T &x){
+        pc.sqr(dst, x);
+    });
+    if (res == pc.one() || res == pc.minus_one()) return true;
+    for (size_t j=1; j<k; ++j)
+    {
+        pc.sqr(res, res);
+        if (res == pc.minus_one()) return true;
+        if (res == pc.one()) return false;
+    }
+    return false;
+}
+
+// the Jacobi symbol (a/n) for odd n > 0
+template<typename T>
+int jacobi(long long a, const T &n)
+{
+    int res = 1;
+    // (-1/n) = -1 for n = 3 (mod 4), (2/n) = -1 for n = 3, 5 (mod 8)
+    const long long n8 = (n % T(8)).to_int();
+    if (a < 0) {
+        a = -a;
+        if (n8 % 4 == 3) res = -res;
+    }
+    while (a % 2 == 0) {
+        a /= 2;
+        if (n8 == 3 || n8 == 5) res = -res;
+    }
+    if (a == 1) return res;
+    // reciprocity, then both are small
+    if (a % 4 == 3 && n8 % 4 == 3) res = -res;
+    long long m = a, x = (n % T(a)).to_int();
+    while (x != 0)
+    {
+        while (x % 2 == 0) {
+            x /= 2;
+            if (m % 8 == 3 || m % 8 == 5) res = -res;
         }
-        pow = pow / T2(2);
-        base = (base * base) % mod;
+        std::swap(x, m);
+        if (x % 4 == 3 && m % 4 == 3) res = -res;
+        x %= m;
     }
-    return res;
+    return m == 1 ? res : 0;
 }
 
 template<typename T>
-bool is_prime(T p)
-{
-    const int prime_list[] = {1, 2, 3, 5, 7, 11, 13, 17, 19, 23,
-                              29, 31, 37, 41, 43, 47, 53, 59, 61, 67,
-                              71, 73, 79, 83, 89, 97, 101, 103, 107, 109,
-                              113, 127, 131, 137, 139, 149, 151, 157, 163,
-                              167, 173, 179, 181, 191, 193, 197, 199, 211, 223, 227};
-    if (p == T(0)) return false;
-    if (p == T(1)) return false;
-    if (p == T(2)) return true;
-    T t = p - T(1), k = T(0);
-    while(t % T(2) == T(0)) {
-        k = k + T(1);
+bool is_square(const T &n)
+{
+    // Newton iteration from above
+    T x = T(1).left_shift(int(n.get_digit_size()+1)/2), y;
+    while (true) {
+        y = (x + n / x) / T(2);
+        if (y >= x) break;
+        x = std::move(y);
+    }
+    return x * x == n;
+}
+
+// Strong Lucas probable prime test with the parameters of Selfridge's method A:
+// D is the first of 5, -7, 9, -11, ... with (D/p) = -1, P = 1 and Q = (1 - D) / 4.
+template<typename T>
+bool strong_lucas_probable_prime(const PrimeTestContext<T> &pc)
+{
+    const T &p = pc.get_mod();
+    long long D = 5;
+    for (int i=0; ; ++i)
+    {
+        int j = jacobi(D, p);
+        if (j == -1) break;
+        if (j == 0 && T(D < 0 ? -D : D) != p) return false;
+        // no such D exists for squares
+        if (i == 10 && is_square(p)) return false;
+        D = D > 0 ? -(D + 2) : -D + 2;
+    }
+    const long long Q = (1 - D) / 4;
+    auto form = [&](long long x) {
+        T a = pc.to_form(T(x < 0 ? -x : x));
+        if (x < 0 && a != T(0)) a = p - a;
+        return a;
+    };
+    const T d_f = form(D), q_f = form(Q);
+
+    // p + 1 = t * 2^s
+    T t = p + T(1);
+    size_t s = 0;
+    while (!(t.digits()[0] & 1)) {
         t = t / T(2);
+        s += 1;
     }
-    for (auto _a : prime_list)
+
+    // U_1 = 1, V_1 = P = 1, Q^1, then up along the bits of t
+    T u = pc.one(), v = pc.one(), qk = q_f, tmp;
+    std::vector<uint8_t> bits = t.to_bits();
+    while (!bits.back()) bits.pop_back();
+    for (size_t i=bits.size()-1; i-- > 0;)
     {
-        T a = T(_a);
-        if (p == a) return true;
-        T res = pow_fast_with_mod(a, t, p);
-        for (T j=T(0); j < k; j = j + T(1))
+        // U_2k = U_k V_k, V_2k = V_k^2 - 2 Q^k
+        pc.mul(u, u, v);
+        pc.sqr(v, v);
+        pc.sub(v, qk);
+        pc.sub(v, qk);
+        pc.sqr(qk, qk);
+        if (bits[i]) {
+            // U_k+1 = (U_k + V_k) / 2, V_k+1 = (D U_k + V_k) / 2
+            pc.mul(tmp, d_f, u);
+            pc.add(u, v);
+            pc.half(u);
+            pc.add(v, tmp);
+            pc.half(v);
+            pc.mul(qk, qk, q_f);
+        }
+    }
+    if (u == T(0) || v == T(0)) return true;
+    for (size_t r=1; r<s; ++r)
+    {
+        pc.sqr(v, v);
+        pc.sub(v, qk);
+        pc.sub(v, qk);
+        if (v == T(0)) return true;
+        pc.sqr(qk, qk);
+    }
+    return false;
+}
+
+// Miller-Rabin rounds with random bases that keep the chance of a random odd candidate of the
+// given bit length passing as a composite below 2^-100, 2^-112 from 1024 bits and 2^-128 from
+// 1536 bits, the targets of FIPS 186-4 Appendix C. The counts come from the bound of Damgard,
+// Landrock and Pomerance, which holds from 82 bits on.
+inline int miller_rabin_rounds(size_t bits)
+{
+    const size_t table[][2] = {{3072, 2}, {2048, 3}, {1280, 4}, {768, 5}, {640, 6}, {512, 8},
+                               {448, 9}, {384, 11}, {320, 13}, {256, 17}, {192, 23}, {160, 24},
+                               {128, 30}, {96, 37}, {82, 41}};
+    for (auto &row : table)
+    {
+        if (bits >= row[0]) return int(row[1]);
+    }
+    return 0;
+}
+
+// below 2^81 the strong tests to the first 13 prime bases decide primality exactly
+const size_t DETERMINISTIC_PRIME_BITS = 81;
+
+const int PRIMALITY_MILLER_RABIN = 0;
+const int PRIMALITY_BAILLIE_PSW = 1;
+
+// Probabilistic primality test, PRIMALITY_MILLER_RABIN runs miller_rabin_rounds(bit length)
+// rounds with bases drawn from e and PRIMALITY_BAILLIE_PSW a strong test to base 2 followed by
+// a strong Lucas test. Small candidates get a deterministic set of bases either way.
+template<typename T, typename Engine>
+bool is_prime(const T &p, Engine &e, int test = PRIMALITY_MILLER_RABIN)
+{
+    if (p <= T(1)) return false;
+    if (p == T(2)) return true;
+    if (!(p.digits()[0] & 1)) return false;
+
+    PrimeTestContext<T> pc(p);
+    // p-1 = t * 2^k
+    T t = p - T(1);
+    size_t k = 0;
+    while (!(t.digits()[0] & 1)) {
+        t = t / T(2);
+        k += 1;
+    }
+
+    const size_t bits = p.bit_length();
+    if (bits <= DETERMINISTIC_PRIME_BITS) {
+        for (int a : {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41})
         {
-            T temp = mul_with_mod(res, res, p);
-            if (temp == T(1) && res != T(1) && res != p - T(1)) return false;
-            res = temp;
+            if (p == T(a)) return true;
+            if (!strong_probable_prime(pc, pc.to_form(T(a)), t, k)) return false;
         }
-        if (res != T(1)) return false;
+        return true;
+    }
+
+    if (test == PRIMALITY_BAILLIE_PSW) {
+        return strong_probable_prime(pc, pc.to_form(T(2)), t, k) && strong_lucas_probable_prime(pc);
+    }
+
+    const T base_range = p - T(3);
+    for (int i=miller_rabin_rounds(bits); i>0; --i)
+    {
+        // a in [2, p-2]
+        T a = random_below(base_range, e) + T(2);
+        if (!strong_probable_prime(pc, pc.to_form(a), t, k)) return false;
     }
     return true;
 }
 
+// A random odd number with size decimal digits: floor(size * log2(10)) random bits with the
+// top one set, which puts it between 10^(size-1) and 10^size. 0 if that doesn't fit T.
+template<typename T, typename Engine>
+T gen_integer(int size, Engine &e)
+{
+    T x;
+    if (!x.fill_random(size_t(size * 3.321928094887362), e, true, true)) {
+        std::cout<<"A random number of "<<size<<" digits doesn\'t fit the integer type!"<<std::endl;
+        return T(0);
+    }
+    return x;
+}
+
+// the first SMALL_PRIME_NUM primes, used to reject candidates before Miller-Rabin
+extern const size_t SMALL_PRIME_NUM;
+const std::vector<uint32_t> &small_primes();
+
+// Small primes packed into products that fit into one digit of T,
+// so that one pass over a candidate gives its remainder by all of them.
+template<typename T>
+struct SmallPrimeGroups
+{
+    std::vector<typename T::DigitType> products;
+    std::vector<size_t> ends; // primes [ends[i-1], ends[i]) make up products[i]
+
+    SmallPrimeGroups()
+    {
+        const auto &primes = small_primes();
+        unsigned long long prod = 1;
+        for (size_t i=0; i<primes.size(); ++i)
+        {
+            if (prod > T::max_digit / primes[i]) {
+                products.push_back(typename T::DigitType(prod));
+                ends.push_back(i);
+                prod = 1;
+            }
+            prod *= primes[i];
+        }
+        products.push_back(typename T::DigitType(prod));
+        ends.push_back(primes.size());
+    }
+
+    static const SmallPrimeGroups &get()
+    {
+        static const SmallPrimeGroups groups;
+        return groups;
+    }
+};
+
+// residues[i] = |x| mod small_primes()[i]
 template<typename T>
-T gen_integer(int size, std::default_random_engine &e)
+void small_prime_residues(const T &x, std::vector<uint32_t> &residues)
 {
-    T l_mod = pow_fast(T(10), size-1);
-    T mod = l_mod * T(10);
-    T res = T(1);
-    while (res < mod) {
-        res = res * T(e());
+    const auto &primes = small_primes();
+    const auto &groups = SmallPrimeGroups<T>::get();
+    std::vector<typename T::DigitType> rem(groups.products.size());
+    x.mod_small_many(groups.products.data(), groups.products.size(), rem.data());
+
+    residues.resize(primes.size());
+    size_t begin = 0;
+    for (size_t g=0; g<rem.size(); ++g)
+    {
+        for (size_t i=begin; i<groups.ends[g]; ++i) residues[i] = uint32_t(rem[g] % primes[i]);
+        begin = groups.ends[g];
     }
-    T temp = res % mod;
-    // check highest digit if is 0
-    if (temp / l_mod == T(0)) temp = temp + l_mod;
-    return temp;
 }
 
+// number of odd offsets from the random start that are sieved at once in gen_prime
+const size_t PRIME_SIEVE_WINDOW = 4096;
+
+// Marks the offsets k in [0, window) for which x + 2k has a small prime factor,
+// or x + 2k = 1 (mod pub_e) so that pub_e would not be invertible modulo x + 2k - 1.
 template<typename T>
-T gen_prime(int size, std::default_random_engine &e, int max_cnt = -1)
+void sieve_prime_window(const T &x, uint32_t pub_e, std::vector<uint8_t> &composite)
+{
+    const auto &primes = small_primes();
+    std::vector<uint32_t> residues;
+    small_prime_residues(x, residues);
+    composite.assign(PRIME_SIEVE_WINDOW, 0);
+
+    // a candidate may itself be one of the small primes when x is tiny
+    const T largest(primes.back());
+    long long small_x = (x <= largest) ? x.to_int() : -1;
+
+    for (size_t i=1; i<primes.size(); ++i)
+    {
+        uint32_t p = primes[i];
+        // x + 2k = 0 (mod p) <=> k = -x * 2^-1 (mod p)
+        size_t k = (size_t)(p - residues[i]) % p * ((p+1)/2) % p;
+        for (; k<PRIME_SIEVE_WINDOW; k+=p)
+        {
+            if (small_x >= 0 && small_x + 2*(long long)k == p) continue;
+            composite[k] = 1;
+        }
+    }
+
+    if (pub_e > 1) {
+        typename T::DigitType d = pub_e, r;
+        x.mod_small_many(&d, 1, &r);
+        // x + 2k = 1 (mod e) <=> k = (1 - x) * 2^-1 (mod e), e is odd
+        size_t k = (size_t)(1 + pub_e - r % pub_e) % pub_e * ((pub_e+1)/2) % pub_e;
+        for (; k<PRIME_SIEVE_WINDOW; k+=pub_e) composite[k] = 1;
+    }
+}
+
+// serializes the progress messages of concurrent prime searches
+inline std::mutex &prime_log_mutex()
+{
+    static std::mutex m;
+    return m;
+}
+
+// Finds a random prime with size decimal digits. Starting from one random odd number it sieves
+// a window of following odd numbers against the small primes and only runs Miller-Rabin on the
+// survivors. With pub_e > 1 (odd), primes p with pub_e | p-1 are skipped.
+// Returns 0 once *stop is set by someone else or after max_cnt (0: no limit) failed candidates.
+// test is passed on to is_prime.
+template<typename T, typename Engine>
+T gen_prime(int size, Engine &e, size_t max_cnt = 0, uint32_t pub_e = 0, const std::atomic<bool> *stop = nullptr,
+            int test = PRIMALITY_MILLER_RABIN)
 {
     T mod = pow_fast(T(10), size);
-    T x = gen_integer<T>(size, e);
-    if (x % T(2) == T(0)) x = x + T(1);
 
     size_t cnt = 0;
     const size_t report_cnt = 1;
-    while(!is_prime(x) || (x >= mod)) {
-        x = gen_integer<T>(size, e);
-        if (x % T(2) == T(0)) x = x + T(1);
-        cnt += 1;
-
-        if (max_cnt > 0 && cnt >= max_cnt) {
-            std::cout<<"Fail to find a random prime number!"<<std::endl;
-            return T(0);
-        }
+    std::vector<uint8_t> composite;
+    while (true)
+    {
+        T x = gen_integer<T>(size, e);
+        if (x == T(0)) return T(0);
+
+        while (x < mod)
+        {
+            sieve_prime_window(x, pub_e, composite);
+            T candidate = x;
+            size_t last_k = 0;
+            for (size_t k=0; k<PRIME_SIEVE_WINDOW; ++k)
+            {
+                if (composite[k]) continue;
+                candidate += T(2*(long long)(k - last_k));
+                last_k = k;
+                if (candidate >= mod) break;
+                if (stop && stop->load(std::memory_order_relaxed)) return T(0);
+
+                if (is_prime(candidate, e, test)) {
+                    std::lock_guard<std::mutex> lock(prime_log_mutex());
+                    std::cout<<"Found a prime number, tested "<<cnt<<" times."<<std::endl;
+                    return candidate;
+                }
+                cnt += 1;
 
-        if (cnt % report_cnt == 0) {
-            std::cout<<"Have tested "<<cnt<<" fake prime number!"<<std::endl;
+                if (max_cnt > 0 && cnt >= max_cnt) {
+                    std::lock_guard<std::mutex> lock(prime_log_mutex());
+                    std::cout<<"Fail to find a random prime number!"<<std::endl;
+                    return T(0);
+                }
+
+                if (cnt % report_cnt == 0) {
+                    std::lock_guard<std::mutex> lock(prime_log_mutex());
+                    std::cout<<"Have tested "<<cnt<<" fake prime number!"<<std::endl;
+                }
+            }
+            // nothing in this window, move on to the next one
+            x += T(2*(long long)PRIME_SIEVE_WINDOW);
         }
     }
+}
 
-    std::cout<<"Found a prime number, tested "<<cnt<<" times."<<std::endl;
-    return x;
+// Runs gen_prime on thread_num threads at once, every thread on its own ChaCha20 stream of key,
+// numbered by (stream, thread index). The first prime found stops the other threads.
+template<typename T>
+T gen_prime_parallel(int size, size_t thread_num, const ChaCha20Key &key, uint32_t stream, uint32_t pub_e = 0,
+                     int test = PRIMALITY_MILLER_RABIN)
+{
+    if (thread_num <= 1) {
+        ChaCha20Engine e(key, uint64_t(stream) << 32);
+        return gen_prime<T>(size, e, 0, pub_e, nullptr, test);
+    }
+
+    std::atomic<bool> stop(false);
+    std::mutex result_mutex;
+    T result;
+
+    std::vector<std::thread> workers;
+    for (uint32_t i=0; i<thread_num; ++i)
+    {
+        workers.emplace_back([&, i]() {
+            ChaCha20Engine e(key, uint64_t(stream) << 32 | i);
+            T x = gen_prime<T>(size, e, 0, pub_e, &stop, test);
+            if (x == T(0)) return;
+
+            std::lock_guard<std::mutex> lock(result_mutex);
+            if (!stop.load()) {
+                result = std::move(x);
+                stop.store(true);
+            }
+        });
+    }
+    for (auto &w : workers) w.join();
+
+    return result;
 }
 
+// KEY_VERSION_DECIMAL keys pack plaintext as 3 decimal digits per byte (fragment_size bytes),
+// KEY_VERSION_DENSE keys pack it as base 256 up to the largest size that is always below n.
+const int KEY_VERSION_DECIMAL = 1;
+const int KEY_VERSION_DENSE = 2;
+
 template<typename T>
 struct RSAKey{
     T n;
     size_t fragment_size; // how many bytes that can encode/decode at a time
     size_t encrypt_fragment_size; // how many digits that a encoded fragment need
     int encrypt_byte_val; // how many digits that a encrypted byte can store
+    int version = KEY_VERSION_DECIMAL; // key files without a version are decimal ones
+    ModulusConstants<T> n_const; // known only for keys read from binary key files
 };
 
 template<typename T>
@@ -165,21 +840,87 @@ template<typename T>
 struct SecreteKey : RSAKey<T>
 {
     T d;
+    // CRT components, all zero for keys that were saved without them
+    T p, q;
+    T dP, dQ; // d mod (p-1), d mod (q-1)
+    T qInv; // q^-1 mod p
+    ModulusConstants<T> p_const, q_const; // like n_const
+
+    bool has_crt() const { return p != T(0); }
 };
 
+// The same non-negative value in another Integer type of the same digits, e.g. a FixedInt
+// picked by the size of a key. False if it doesn't fit T.
+template<typename T, typename U>
+bool integer_cast(const U &x, T &y)
+{
+    static_assert(std::is_same_v<typename T::DigitType, typename U::DigitType> && T::max_digit == U::max_digit);
+    return y.from_digits(x.digits(), x.get_digit_size());
+}
+
+template<typename T, typename U>
+bool modulus_constants_cast(const ModulusConstants<U> &a, ModulusConstants<T> &b)
+{
+    b.known = a.known;
+    b.n_inv = a.n_inv;
+    return integer_cast(a.r_mod, b.r_mod) && integer_cast(a.r2_mod, b.r2_mod) && integer_cast(a.mu, b.mu);
+}
+
+// a key in another Integer type, see integer_cast
+template<typename T, typename U>
+bool key_cast(const RSAKey<U> &a, RSAKey<T> &b)
+{
+    b.fragment_size = a.fragment_size;
+    b.encrypt_fragment_size = a.encrypt_fragment_size;
+    b.encrypt_byte_val = a.encrypt_byte_val;
+    b.version = a.version;
+    return integer_cast(a.n, b.n) && modulus_constants_cast(a.n_const, b.n_const);
+}
+
+template<typename T, typename U>
+bool key_cast(const PublicKey<U> &a, PublicKey<T> &b)
+{
+    return key_cast(static_cast<const RSAKey<U>&>(a), static_cast<RSAKey<T>&>(b)) && integer_cast(a.e, b.e);
+}
+
+template<typename T, typename U>
+bool key_cast(const SecreteKey<U> &a, SecreteKey<T> &b)
+{
+    return key_cast(static_cast<const RSAKey<U>&>(a), static_cast<RSAKey<T>&>(b)) && integer_cast(a.d, b.d)
+        && integer_cast(a.p, b.p) && integer_cast(a.q, b.q) && integer_cast(a.dP, b.dP) && integer_cast(a.dQ, b.dQ)
+        && integer_cast(a.qInv, b.qInv) && modulus_constants_cast(a.p_const, b.p_const) && modulus_constants_cast(a.q_const, b.q_const);
+}
+
 extern const size_t DIGIT_NUM_OF_ONE_BYTE;
 
 template<typename T, int encrypt_byte_val=10>
-void gen_key_pair(size_t size, PublicKey<T> &pk, SecreteKey<T> &sk)
+bool gen_key_pair(size_t size, PublicKey<T> &pk, SecreteKey<T> &sk, size_t thread_num = 1, int test = PRIMALITY_MILLER_RABIN)
 {
     std::cout<<"> about to generate ras key pair that can handle at least "<<size<<" of digits at a time."<<std::endl;
 
-    std::default_random_engine engine(time(nullptr));
+    // the primes come from ChaCha20 keyed by the system, keys of runs started at the same time
+    // differ. Without a working generator or system randomness there are no keys at all.
+    ChaCha20Key key;
+    if (!chacha20_self_test() || !chacha20_os_key(key)) return false;
+
     size_t p_size = size/2;
     size_t q_size = size - p_size;
 
-    T p = gen_prime<T>(p_size, engine);
-    T q = gen_prime<T>(q_size, engine);
+    const uint32_t pub_e = 17;
+    T p, q;
+    if (thread_num <= 1) {
+        ChaCha20Engine engine(key);
+        p = gen_prime<T>(p_size, engine, 0, pub_e, nullptr, test);
+        q = gen_prime<T>(q_size, engine, 0, pub_e, nullptr, test);
+    } else {
+        // p and q are searched at the same time, each by half of the threads
+        size_t p_threads = thread_num/2;
+        size_t q_threads = thread_num - p_threads;
+        std::thread p_search([&]() { p = gen_prime_parallel<T>(p_size, p_threads, key, 0, pub_e, test); });
+        q = gen_prime_parallel<T>(q_size, q_threads, key, 1, pub_e, test);
+        p_search.join();
+    }
+    if (p == T(0) || q == T(0)) return false;
 
     std::cout<<"> generated p: "<<p<<std::endl;
     std::cout<<"> generated q: "<<q<<std::endl;
@@ -187,14 +928,14 @@ void gen_key_pair(size_t size, PublicKey<T> &pk, SecreteKey<T> &sk)
     T n = p * q;
     std::cout<<"> calc n: "<<n<<std::endl;
 
-    T e = T(17);
+    T e = T(pub_e);
     std::cout<<"> choose e: "<<e<<std::endl;
 
     T d;
     {
         T _a = e, _b = (p - T(1)) * (q - T(1)), _c, _x, _y;
         ext_gcd(_a, _b, _c, _x, _y);
-        d = (_x + _b) % _b;
+        d = _x < T(0) ? _x + _b : _x;
         if (_c != T(1)) {
             std::cout<<"something went wrong while calculating d, maybe p or q is not a prime number."<<std::endl;
         }
@@ -202,6 +943,18 @@ void gen_key_pair(size_t size, PublicKey<T> &pk, SecreteKey<T> &sk)
     }
     std::cout<<"> calc d: "<<d<<std::endl;
 
+    T q_inv;
+    {
+        T _a = q, _b = p, _c, _x, _y;
+        ext_gcd(_a, _b, _c, _x, _y);
+        q_inv = _x < T(0) ? _x + _b : _x;
+    }
+    T dp = d % (p - T(1));
+    T dq = d % (q - T(1));
+    std::cout<<"> calc dP: "<<dp<<std::endl;
+    std::cout<<"> calc dQ: "<<dq<<std::endl;
+    std::cout<<"> calc qInv: "<<q_inv<<std::endl;
+
     T temp = n, temp2 = T(encrypt_byte_val);
     size_t encrypt_fragment_size = 0;
     while (temp > T(0))
@@ -215,16 +968,43 @@ void gen_key_pair(size_t size, PublicKey<T> &pk, SecreteKey<T> &sk)
     pk.fragment_size = (size-1)/DIGIT_NUM_OF_ONE_BYTE;
     pk.encrypt_fragment_size = encrypt_fragment_size;
     pk.encrypt_byte_val = encrypt_byte_val;
+    pk.version = KEY_VERSION_DENSE;
 
     sk.d = d;
     sk.n = n;
+    sk.p = p;
+    sk.q = q;
+    sk.dP = dp;
+    sk.dQ = dq;
+    sk.qInv = q_inv;
     sk.fragment_size = (size-1)/DIGIT_NUM_OF_ONE_BYTE;
     sk.encrypt_fragment_size = encrypt_fragment_size;
     sk.encrypt_byte_val = encrypt_byte_val;
+    sk.version = KEY_VERSION_DENSE;
 
     std::cout<<"> frag size: "<<pk.fragment_size<<std::endl;
     std::cout<<"> encrypt frag size: "<<pk.encrypt_fragment_size<<std::endl;
     std::cout<<"> encrypt_byte_val: "<<pk.encrypt_byte_val<<std::endl;
+    return true;
+}
+
+// c^d mod n through the CRT components of sk, recombined with Garner's formula
+template<typename T>
+T pow_with_crt(const T &c, const SecreteKey<T> &sk, const MontgomeryContext<T> &p_ctx, const MontgomeryContext<T> &q_ctx,
+               const BarrettReducer<T> &p_red)
+{
+    T m1 = pow_fast_with_mod(c, sk.dP, p_ctx);
+    T m2 = pow_fast_with_mod(c, sk.dQ, q_ctx);
+    // h = qInv * (m1 - m2) mod p
+    T h = m2;
+    p_red.reduce(h);
+    h = sk.p - h;
+    h += m1;
+    if (h >= sk.p) h -= sk.p;
+    p_red.multiply_into(h, h, sk.qInv);
+    T::mul_into(h, h, sk.q);
+    h += m2;
+    return h;
 }
 
 template<typename T>
@@ -242,10 +1022,19 @@ std::string print_array(const std::vector<T> &arr)
 }
 
 
+// f(i) for every fragment i in [0, n), spread over pool when there is one
+template<typename F>
+void for_each_fragment(size_t n, ThreadPool *pool, F f)
+{
+    if (pool && pool->size() > 1 && n > 1) pool->parallel_for(n, f);
+    else for (size_t i=0; i<n; ++i) f(i);
+}
+
 template<typename T>
-std::vector<uint8_t> encrypt(const std::vector<uint8_t> &row_data, const PublicKey<T> &pk)
+std::vector<uint8_t> encrypt(const std::vector<uint8_t> &row_data, const PublicKey<T> &pk, ThreadPool *pool = nullptr)
 {
     T _3_d = pow_fast(T(10), DIGIT_NUM_OF_ONE_BYTE);
+    MontgomeryContext<T> ctx(pk.n, pk.n_const);
     size_t row_data_pos = 0;
     std::vector<T> C_groups;
     while (row_data_pos < row_data.size())
@@ -253,38 +1042,41 @@ std::vector<uint8_t> encrypt(const std::vector<uint8_t> &row_data, const PublicK
         T M = T(0);
         for (size_t i=0; i<pk.fragment_size; ++i)
         {
-            M = M + T(row_data[row_data_pos++]);
+            M += T(row_data[row_data_pos++]);
 
             if (row_data_pos >= row_data.size() || i == pk.fragment_size-1) break;
 
-            M = M * _3_d;
+            M *= _3_d;
         }
 
-        T C = pow_fast_with_mod(M, pk.e, pk.n);
-        C_groups.push_back(C);
+        C_groups.push_back(std::move(M));
     }
 
 //    std::cout<<"en: C_group = "<<print_array(C_groups)<<std::endl;
 
-    // use one byte to store 1 digit
-    std::vector<uint8_t> res;
-    for (size_t i=0; i<C_groups.size(); ++i)
-    {
-        T C = C_groups[i];
+    // use one byte to store 1 digit, every fragment owns its slice of res
+    std::vector<uint8_t> res(C_groups.size() * pk.encrypt_fragment_size);
+    const T byte_val(pk.encrypt_byte_val);
+    for_each_fragment(C_groups.size(), pool, [&](size_t i) {
+        T C = pow_fast_with_mod(C_groups[i], pk.e, ctx);
+        T digit, rest;
+        uint8_t *out = res.data() + i * pk.encrypt_fragment_size;
         for (size_t j=0; j<pk.encrypt_fragment_size; ++j)
         {
-            res.push_back(C % T(pk.encrypt_byte_val));
-            C = C / T(pk.encrypt_byte_val);
+            C.mod_div(byte_val, digit, rest);
+            out[j] = digit;
+            C = std::move(rest);
         }
-    }
+    });
 
     return res;
 }
 
 template<typename T>
-std::vector<uint8_t> decrypt(const std::vector<uint8_t> &row_data, const SecreteKey<T> &sk)
+std::vector<uint8_t> decrypt(const std::vector<uint8_t> &row_data, const SecreteKey<T> &sk, ThreadPool *pool = nullptr)
 {
     std::vector<T> C_groups;
+    const T byte_val(sk.encrypt_byte_val);
     // use one byte to store 1 digit
     for (size_t i=0; i<row_data.size(); i += sk.encrypt_fragment_size)
     {
@@ -295,35 +1087,38 @@ std::vector<uint8_t> decrypt(const std::vector<uint8_t> &row_data, const Secrete
                 std::cout<<"The source data is wrong, may be broken."<<std::endl;
                 break;
             }
-            auto t = T(row_data[row_data.size()-(i+j)-1]);
-            C = C + t;
+            C += T(row_data[row_data.size()-(i+j)-1]);
             if (j == sk.encrypt_fragment_size-1) break;
-            C = C * T(sk.encrypt_byte_val);
+            C *= byte_val;
         }
-        C_groups.push_back(C);
+        C_groups.push_back(std::move(C));
     }
 
 //    std::cout<<"de: C_group = "<<print_array(C_groups)<<std::endl;
 
     T _3_d = pow_fast(T(10), DIGIT_NUM_OF_ONE_BYTE);
-    std::stack<uint8_t> res_stack;
-    for (size_t i=0; i<C_groups.size(); ++i)
-    {
-        T M = pow_fast_with_mod(C_groups[i], sk.d, sk.n);
-
+    MontgomeryContext<T> ctx(sk.n, sk.n_const), p_ctx(sk.p, sk.p_const), q_ctx(sk.q, sk.q_const);
+    BarrettReducer<T> p_red(sk.p, sk.p_const);
+    // the bytes of each fragment come out last byte first
+    std::vector<std::vector<uint8_t>> M_groups(C_groups.size());
+    for_each_fragment(C_groups.size(), pool, [&](size_t i) {
+        const T &C = C_groups[i];
+        T M = sk.has_crt() ? pow_with_crt(C, sk, p_ctx, q_ctx, p_red) : pow_fast_with_mod(C, sk.d, ctx);
+        T digit, rest;
         for (size_t j=0; j<sk.fragment_size; ++j)
         {
-            res_stack.push(M % _3_d);
-            M = M / _3_d;
+            M.mod_div(_3_d, digit, rest);
+            M_groups[i].push_back(digit);
+            M = std::move(rest);
             if (M == T(0)) break;
         }
-    }
+    });
 
+    // the whole output is read backwards, so is the list of fragments
     std::vector<uint8_t> res;
-    while (!res_stack.empty())
+    for (size_t i=M_groups.size(); i-- > 0; )
     {
-        res.push_back(res_stack.top());
-        res_stack.pop();
+        res.insert(res.end(), M_groups[i].rbegin(), M_groups[i].rend());
     }
 
     return res;
@@ -332,6 +1127,289 @@ std::vector<uint8_t> decrypt(const std::vector<uint8_t> &row_data, const Secrete
 std::vector<uint8_t> string_to_bytes(const std::string &s);
 std::string bytes_to_string(const std::vector<uint8_t> &bytes);
 std::string bytes_to_base64(const std::vector<uint8_t> &bytes);
-std::vector<uint8_t> base64_to_bytes(const std::string &s);
+// false if s is not valid base64, see base64_decode
+bool base64_to_bytes(const std::string &s, std::vector<uint8_t> &bytes);
+
+// Streamed ciphertext starts with a header: CIPHER_MAGIC, a version byte and the plaintext length
+// (8 bytes, little endian), then the fragments follow in file order. Legacy ciphertext has no
+// header, it can't start with 0xFF since its bytes are digits below encrypt_byte_val.
+// When the length isn't known up front (piped input) the header holds CIPHER_LENGTH_UNKNOWN and
+// every block of fragments is preceded by its plaintext length (4 bytes, little endian), a block
+// of length 0 ends the stream.
+extern const uint8_t CIPHER_MAGIC[4];
+const uint8_t CIPHER_VERSION_STREAM = 1; // ciphertext fragments as base encrypt_byte_val digits
+const uint8_t CIPHER_VERSION_PACKED = 2; // ciphertext fragments as big-endian bytes of n's width
+const uint8_t CIPHER_VERSION_DENSE = 3; // like CIPHER_VERSION_PACKED, plaintext packed as base 256
+const size_t CIPHER_HEADER_SIZE = 13;
+const uint64_t CIPHER_LENGTH_UNKNOWN = ~uint64_t(0);
+const size_t CIPHER_BLOCK_LENGTH_SIZE = 4;
+
+struct CipherHeader
+{
+    uint8_t version;
+    uint64_t length; // plaintext bytes
+};
+
+std::vector<uint8_t> cipher_header_to_bytes(const CipherHeader &header);
+// false if data doesn't start with a header of a known version
+bool cipher_header_from_bytes(const std::vector<uint8_t> &data, CipherHeader &header);
+
+// size of the blocks that files are read in
+const size_t STREAM_BLOCK_SIZE = 1 << 20;
+
+// Reads a stream in blocks of STREAM_BLOCK_SIZE, decoding base64 on the way when asked to.
+class ByteReader
+{
+    std::istream &in;
+    bool base64;
+    std::vector<uint8_t> buffer; // decoded, not handed out yet
+    size_t pos = 0;
+    std::string text; // base64 characters not decoded yet
+    bool invalid = false;
+
+    bool fill();
+public:
+    ByteReader(std::istream &in, bool base64) : in(in), base64(base64) {}
+
+    // true once the input turned out not to be valid base64
+    bool is_invalid() const { return invalid; }
+
+    // appends up to n bytes to out, less only at the end of the stream, returns how many
+    size_t read(std::vector<uint8_t> &out, size_t n);
+};
+
+// Writes to a stream, encoding base64 on the way when asked to.
+class ByteWriter
+{
+    std::ostream &out;
+    bool base64;
+    std::vector<uint8_t> pending; // less than 3 bytes that don't make a base64 quantum yet
+    std::string text; // encoding buffer, kept between writes
+public:
+    ByteWriter(std::ostream &out, bool base64) : out(out), base64(base64) {}
+
+    void write(const std::vector<uint8_t> &data);
+    // writes the base64 padding, nothing can be written after it
+    void finish();
+};
+
+// bytes taken by one ciphertext fragment in the given format version
+template<typename T>
+size_t cipher_fragment_size(const RSAKey<T> &key, uint8_t version)
+{
+    if (version == CIPHER_VERSION_STREAM) return key.encrypt_fragment_size;
+    return (key.n.bit_length() + 7) / 8;
+}
+
+// plaintext bytes in one fragment in the given format version, 0 if n is too small for it
+template<typename T>
+size_t plain_fragment_size(const RSAKey<T> &key, uint8_t version)
+{
+    if (version != CIPHER_VERSION_DENSE) return key.fragment_size;
+    // any value of that many bytes is below 2^(bits(n)-1) <= n
+    size_t bits = key.n.bit_length();
+    return bits > 0 ? (bits - 1) / 8 : 0;
+}
+
+// format written by encrypt_stream for a key
+template<typename T>
+uint8_t cipher_version_of(const PublicKey<T> &pk)
+{
+    if (pk.version >= KEY_VERSION_DENSE && plain_fragment_size(pk, CIPHER_VERSION_DENSE) > 0) return CIPHER_VERSION_DENSE;
+    return CIPHER_VERSION_PACKED;
+}
+
+// Encrypts size bytes as fragments of plain_fragment_size bytes (the last one may be shorter), appending
+// every ciphertext to out in the layout of the format version, most significant byte first.
+template<typename T>
+void encrypt_block(const uint8_t *data, size_t size, const PublicKey<T> &pk, const MontgomeryContext<T> &ctx, uint8_t version, ThreadPool *pool, std::vector<uint8_t> &out)
+{
+    const size_t plain_bytes = plain_fragment_size(pk, version);
+    const size_t frag_num = (size + plain_bytes - 1) / plain_bytes;
+    const size_t frag_bytes = cipher_fragment_size(pk, version);
+    const size_t begin = out.size();
+    out.resize(begin + frag_num * frag_bytes);
+
+    const T _3_d = pow_fast(T(10), DIGIT_NUM_OF_ONE_BYTE);
+    const T byte_val(pk.encrypt_byte_val);
+    for_each_fragment(frag_num, pool, [&](size_t i) {
+        const uint8_t *src = data + i * plain_bytes;
+        size_t len = std::min(plain_bytes, size - i * plain_bytes);
+        T M(0);
+        if (version == CIPHER_VERSION_DENSE) M.from_bytes(src, len);
+        else {
+            for (size_t j=0; j<len; ++j)
+            {
+                M *= _3_d;
+                M += T(src[j]);
+            }
+        }
+
+        T C = pow_fast_with_mod(M, pk.e, ctx);
+        if (version != CIPHER_VERSION_STREAM) {
+            C.to_bytes(out.data() + begin + i * frag_bytes, frag_bytes);
+            return;
+        }
+
+        T digit, rest;
+        uint8_t *dst = out.data() + begin + (i+1) * frag_bytes;
+        for (size_t j=0; j<frag_bytes; ++j)
+        {
+            C.mod_div(byte_val, digit, rest);
+            *--dst = digit;
+            C = std::move(rest);
+        }
+    });
+}
+
+// Reverse of encrypt_block for frag_num whole fragments that decrypt to size bytes in total,
+// the size of the last fragment comes from the length in the header.
+template<typename T>
+void decrypt_block(const uint8_t *data, size_t frag_num, size_t size, const SecreteKey<T> &sk,
+                   const MontgomeryContext<T> &ctx, const MontgomeryContext<T> &p_ctx, const MontgomeryContext<T> &q_ctx,
+                   const BarrettReducer<T> &p_red,
+                   uint8_t version, ThreadPool *pool, std::vector<uint8_t> &out)
+{
+    const size_t plain_bytes = plain_fragment_size(sk, version);
+    const size_t frag_bytes = cipher_fragment_size(sk, version);
+    const size_t begin = out.size();
+    out.resize(begin + size);
+
+    const T _3_d = pow_fast(T(10), DIGIT_NUM_OF_ONE_BYTE);
+    const T byte_val(sk.encrypt_byte_val);
+    for_each_fragment(frag_num, pool, [&](size_t i) {
+        const uint8_t *src = data + i * frag_bytes;
+        T C(0);
+        if (version != CIPHER_VERSION_STREAM) C.from_bytes(src, frag_bytes);
+        else {
+            for (size_t j=0; j<frag_bytes; ++j)
+            {
+                C *= byte_val;
+                C += T(src[j]);
+            }
+        }
+
+        T M = sk.has_crt() ? pow_with_crt(C, sk, p_ctx, q_ctx, p_red) : pow_fast_with_mod(C, sk.d, ctx);
+        size_t len = std::min(plain_bytes, size - i * plain_bytes);
+        if (version == CIPHER_VERSION_DENSE) {
+            M.to_bytes(out.data() + begin + i * plain_bytes, len);
+            return;
+        }
+
+        T digit, rest;
+        uint8_t *dst = out.data() + begin + i * plain_bytes + len;
+        for (size_t j=0; j<len; ++j)
+        {
+            M.mod_div(_3_d, digit, rest);
+            *--dst = digit;
+            M = std::move(rest);
+        }
+    });
+}
+
+// plaintext bytes that encrypt_stream puts in one block, a whole number of fragments
+template<typename T>
+size_t stream_block_size(const RSAKey<T> &key, uint8_t version)
+{
+    const size_t plain_bytes = plain_fragment_size(key, version);
+    return std::max<size_t>(1, STREAM_BLOCK_SIZE / plain_bytes) * plain_bytes;
+}
+
+// Encrypts length bytes from in into the streamed format, one block at a time. With length
+// CIPHER_LENGTH_UNKNOWN it reads to the end of in and writes the length of every block.
+template<typename T>
+bool encrypt_stream(std::istream &in, uint64_t length, std::ostream &out, const PublicKey<T> &pk, ThreadPool *pool = nullptr, bool base64 = false)
+{
+    ByteWriter writer(out, base64);
+    const uint8_t version = cipher_version_of(pk);
+    writer.write(cipher_header_to_bytes({version, length}));
+
+    MontgomeryContext<T> ctx(pk.n, pk.n_const);
+    const bool framed = length == CIPHER_LENGTH_UNKNOWN;
+    const size_t block_size = stream_block_size(pk, version);
+    std::vector<uint8_t> M(block_size), C;
+    uint64_t done = 0;
+    while (framed || done < length)
+    {
+        size_t size = framed ? block_size : size_t(std::min<uint64_t>(block_size, length - done));
+        in.read(reinterpret_cast<char*>(M.data()), std::streamsize(size));
+        size_t got = size_t(in.gcount());
+        if (!framed && got != size) {
+            std::cout<<"The source data ended before "<<length<<" bytes."<<std::endl;
+            return false;
+        }
+
+        C.clear();
+        if (framed) {
+            for (size_t i=0; i<CIPHER_BLOCK_LENGTH_SIZE; ++i) C.push_back(uint8_t(got >> (8*i)));
+            if (got == 0) {
+                writer.write(C);
+                break;
+            }
+        }
+        encrypt_block(M.data(), got, pk, ctx, version, pool, C);
+        writer.write(C);
+        done += got;
+    }
+    writer.finish();
+    return true;
+}
+
+// Decrypts both the streamed format and the legacy one, which still has to be read as a whole.
+template<typename T>
+bool decrypt_stream(std::istream &in, std::ostream &out, const SecreteKey<T> &sk, ThreadPool *pool = nullptr, bool base64 = false)
+{
+    ByteReader reader(in, base64);
+    ByteWriter writer(out, false);
+
+    std::vector<uint8_t> C;
+    reader.read(C, CIPHER_HEADER_SIZE);
+    CipherHeader header;
+    if (!cipher_header_from_bytes(C, header)) {
+        while (reader.read(C, STREAM_BLOCK_SIZE) > 0) ;
+        if (reader.is_invalid()) return false;
+        writer.write(decrypt(C, sk, pool));
+        return true;
+    }
+
+    MontgomeryContext<T> ctx(sk.n, sk.n_const), p_ctx(sk.p, sk.p_const), q_ctx(sk.q, sk.q_const);
+    BarrettReducer<T> p_red(sk.p, sk.p_const);
+    const bool framed = header.length == CIPHER_LENGTH_UNKNOWN;
+    const size_t plain_bytes = plain_fragment_size(sk, header.version);
+    const size_t block_size = stream_block_size(sk, header.version);
+    const size_t frag_bytes = cipher_fragment_size(sk, header.version);
+    std::vector<uint8_t> M;
+    uint64_t done = 0;
+    while (framed || done < header.length)
+    {
+        size_t size = 0;
+        if (framed) {
+            C.clear();
+            if (reader.read(C, CIPHER_BLOCK_LENGTH_SIZE) != CIPHER_BLOCK_LENGTH_SIZE) {
+                if (!reader.is_invalid()) std::cout<<"The source data is wrong, may be broken."<<std::endl;
+                return false;
+            }
+            for (size_t i=0; i<CIPHER_BLOCK_LENGTH_SIZE; ++i) size |= size_t(C[i]) << (8*i);
+            if (size == 0) break;
+            if (size > block_size) {
+                std::cout<<"The source data is wrong, may be broken."<<std::endl;
+                return false;
+            }
+        } else size = size_t(std::min<uint64_t>(block_size, header.length - done));
+
+        size_t frag_num = (size + plain_bytes - 1) / plain_bytes;
+        C.clear();
+        if (reader.read(C, frag_num * frag_bytes) != frag_num * frag_bytes) {
+            if (!reader.is_invalid()) std::cout<<"The source data is wrong, may be broken."<<std::endl;
+            return false;
+        }
+
+        M.clear();
+        decrypt_block(C.data(), frag_num, size, sk, ctx, p_ctx, q_ctx, p_red, header.version, pool, M);
+        writer.write(M);
+        done += size;
+    }
+    return true;
+}
 
 #endif //RSA_TOOL_RSA_H
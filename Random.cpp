@@ -0,0 +1,111 @@
+#include "Random.h"
+
+#include <fstream>
+#include <iostream>
+#include <random>
+
+bool os_entropy(uint8_t *out, size_t n)
+{
+#ifndef _WIN32
+    std::ifstream in("/dev/urandom", std::ios::in | std::ios::binary);
+    if (in.read(reinterpret_cast<char*>(out), std::streamsize(n))) return true;
+#endif
+    try {
+        std::random_device rd;
+        for (size_t i=0; i<n; i+=4)
+        {
+            uint32_t x = rd();
+            for (size_t j=0; j<4 && i+j<n; ++j) out[i+j] = uint8_t(x >> (8*j));
+        }
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+static uint32_t load_le32(const uint8_t *in)
+{
+    return uint32_t(in[0]) | uint32_t(in[1]) << 8 | uint32_t(in[2]) << 16 | uint32_t(in[3]) << 24;
+}
+
+bool chacha20_os_key(ChaCha20Key &key)
+{
+    uint8_t bytes[32];
+    if (!os_entropy(bytes, sizeof(bytes))) {
+        std::cout<<"Can\'t get random bytes from the system."<<std::endl;
+        return false;
+    }
+    for (size_t i=0; i<8; ++i) key[i] = load_le32(bytes + 4*i);
+    return true;
+}
+
+static inline uint32_t rotl(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+static inline void quarter_round(uint32_t *x, int a, int b, int c, int d)
+{
+    x[a] += x[b]; x[d] = rotl(x[d] ^ x[a], 16);
+    x[c] += x[d]; x[b] = rotl(x[b] ^ x[c], 12);
+    x[a] += x[b]; x[d] = rotl(x[d] ^ x[a], 8);
+    x[c] += x[d]; x[b] = rotl(x[b] ^ x[c], 7);
+}
+
+ChaCha20Engine::ChaCha20Engine(const ChaCha20Key &key, uint64_t stream)
+{
+    // "expand 32-byte k"
+    state[0] = 0x61707865;
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    for (size_t i=0; i<8; ++i) state[4+i] = key[i];
+    state[12] = state[13] = 0;
+    state[14] = uint32_t(stream);
+    state[15] = uint32_t(stream >> 32);
+}
+
+void ChaCha20Engine::seek(uint64_t block_num)
+{
+    state[12] = uint32_t(block_num);
+    state[13] = uint32_t(block_num >> 32);
+    pos = 16;
+}
+
+void ChaCha20Engine::refill()
+{
+    for (size_t i=0; i<16; ++i) block[i] = state[i];
+    for (int i=0; i<10; ++i)
+    {
+        quarter_round(block, 0, 4, 8, 12);
+        quarter_round(block, 1, 5, 9, 13);
+        quarter_round(block, 2, 6, 10, 14);
+        quarter_round(block, 3, 7, 11, 15);
+        quarter_round(block, 0, 5, 10, 15);
+        quarter_round(block, 1, 6, 11, 12);
+        quarter_round(block, 2, 7, 8, 13);
+        quarter_round(block, 3, 4, 9, 14);
+    }
+    for (size_t i=0; i<16; ++i) block[i] += state[i];
+    if (++state[12] == 0) ++state[13];
+    pos = 0;
+}
+
+bool chacha20_self_test()
+{
+    // key 00 01 .. 1f, nonce 00 00 00 09 00 00 00 4a 00 00 00 00, block counter 1: in the
+    // layout here the counter word 13 holds the first nonce word and the stream the other two
+    ChaCha20Key key;
+    for (size_t i=0; i<8; ++i) key[i] = uint32_t(4*i) | uint32_t(4*i+1) << 8 | uint32_t(4*i+2) << 16 | uint32_t(4*i+3) << 24;
+    ChaCha20Engine e(key, 0x4a000000);
+    e.seek(0x0900000000000001ull);
+    const uint32_t expected[16] = {
+        0xe4e7f110, 0x15593bd1, 0x1fdd0f50, 0xc47120a3, 0xc7f4d1c7, 0x0368c033, 0x9aaa2204, 0x4e6cd4c3,
+        0x466482d2, 0x09aa9f07, 0x05d7c214, 0xa2028bd9, 0xd19c12b5, 0xb94e16de, 0xe883d0cb, 0x4e3c50a2,
+    };
+    for (uint32_t x : expected)
+    {
+        if (e() != x) {
+            std::cout<<"The ChaCha20 generator fails its known answer test."<<std::endl;
+            return false;
+        }
+    }
+    return true;
+}
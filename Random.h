@@ -0,0 +1,49 @@
+#ifndef RSA_TOOL_RANDOM_H
+#define RSA_TOOL_RANDOM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+
+using ChaCha20Key = std::array<uint32_t, 8>;
+
+// Fills out with n bytes from the operating system (/dev/urandom, std::random_device where
+// that doesn't exist). Returns false if no source could be read.
+bool os_entropy(uint8_t *out, size_t n);
+
+// A new key from os_entropy. Returns false if the system has no randomness to give,
+// nothing that needs unpredictable numbers may go on then.
+bool chacha20_os_key(ChaCha20Key &key);
+
+// Known answer test of the block function, the test vector of RFC 8439 section 2.3.2.
+bool chacha20_self_test();
+
+// ChaCha20 keystream as a random bit generator, usable with <random> and with everything that
+// takes an Engine here. The 256 bit key and a 64 bit stream number pick the stream and a 64 bit
+// block counter runs through it (the original layout of the cipher, words 12-13 the counter,
+// 14-15 the stream), so one key serves many independent streams, e.g. one per thread.
+class ChaCha20Engine
+{
+    uint32_t state[16];
+    uint32_t block[16];
+    size_t pos = 16; // next word of block, 16 when it is used up
+
+    void refill();
+public:
+    using result_type = uint32_t;
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return 0xffffffffu; }
+
+    explicit ChaCha20Engine(const ChaCha20Key &key, uint64_t stream = 0);
+
+    // continues with block number block_num of the stream
+    void seek(uint64_t block_num);
+
+    result_type operator()()
+    {
+        if (pos == 16) refill();
+        return block[pos++];
+    }
+};
+
+#endif //RSA_TOOL_RANDOM_H
@@ -0,0 +1,64 @@
+#ifndef RSA_TOOL_THREADPOOL_H
+#define RSA_TOOL_THREADPOOL_H
+
+#include <cstddef>
+#include <algorithm>
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+// Fixed set of worker threads taking tasks from one queue.
+class ThreadPool
+{
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+
+    void worker_loop();
+public:
+    // thread_num = 0 means one thread per hardware thread
+    explicit ThreadPool(size_t thread_num = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t size() const { return workers.size(); }
+
+    void submit(std::function<void()> task);
+
+    // Calls f(i) for every i in [0, n) on the pool and returns when all calls are done.
+    // The indices are handed out one at a time, so uneven calls still balance.
+    template<typename F>
+    void parallel_for(size_t n, F f)
+    {
+        if (n == 0) return;
+
+        std::atomic<size_t> next(0);
+        const size_t task_num = std::min(n, workers.size());
+        size_t running = task_num;
+        std::mutex done_mutex;
+        std::condition_variable done_cv;
+
+        for (size_t t=0; t<task_num; ++t)
+        {
+            submit([&]() {
+                for (size_t i=next++; i<n; i=next++) f(i);
+
+                std::lock_guard<std::mutex> lock(done_mutex);
+                if (--running == 0) done_cv.notify_one();
+            });
+        }
+
+        std::unique_lock<std::mutex> lock(done_mutex);
+        done_cv.wait(lock, [&]() { return running == 0; });
+    }
+};
+
+#endif //RSA_TOOL_THREADPOOL_H
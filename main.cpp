@@ -1,16 +1,41 @@
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <memory>
+#include <type_traits>
 
 #include "Integer.h"
 #include "RSA.h"
+#include "KeyFile.h"
 
-void generate_key_pair(int size=50, const std::string &pk_file_name="pk.txt", const std::string &sk_file_name="sk.txt")
+#ifdef __SIZEOF_INT128__
+using IntegerType = VarInteger64;
+#else
+using IntegerType = VarInteger32;
+#endif
+
+void generate_key_pair(int size=50, const std::string &pk_file_name="pk.txt", const std::string &sk_file_name="sk.txt", int thread_num=0, bool binary=false,
+                       bool baillie_psw=false)
 {
-    using IntegerType = Integer<>;
+    // 0 means one thread per hardware thread
+    if (thread_num <= 0) thread_num = std::max(1u, std::thread::hardware_concurrency());
+
     PublicKey<IntegerType> pk;
     SecreteKey<IntegerType> sk;
-    gen_key_pair<IntegerType, 255>(size, pk, sk);
+    if (!gen_key_pair<IntegerType, 255>(size, pk, sk, thread_num, baillie_psw ? PRIMALITY_BAILLIE_PSW : PRIMALITY_MILLER_RABIN)) {
+        std::cout<<"Key generation aborted, no key files were written."<<std::endl;
+        return;
+    }
+
+    if (binary) {
+        std::cout<<"Writing pk file..."<<std::endl;
+        if (!save_key_file(pk_file_name, pk)) return;
+        std::cout<<"Writing to pk file done. "<<pk_file_name<<std::endl;
+        std::cout<<"Writing sk file..."<<std::endl;
+        if (!save_key_file(sk_file_name, sk)) return;
+        std::cout<<"Writing to sk file done. "<<sk_file_name<<std::endl;
+        return;
+    }
 
     std::cout<<"Writing pk file..."<<std::endl;
     std::ofstream pk_f(pk_file_name);
@@ -19,6 +44,7 @@ void generate_key_pair(int size=50, const std::string &pk_file_name="pk.txt", co
     pk_f<<pk.fragment_size<<std::endl;
     pk_f<<pk.encrypt_fragment_size<<std::endl;
     pk_f<<pk.encrypt_byte_val<<std::endl;
+    pk_f<<pk.version<<std::endl;
     pk_f.flush();
     pk_f.close();
     std::cout<<"Writing to pk file done. "<<pk_file_name<<std::endl;
@@ -30,26 +56,66 @@ void generate_key_pair(int size=50, const std::string &pk_file_name="pk.txt", co
     sk_f<<sk.fragment_size<<std::endl;
     sk_f<<sk.encrypt_fragment_size<<std::endl;
     sk_f<<sk.encrypt_byte_val<<std::endl;
+    sk_f<<sk.p<<std::endl;
+    sk_f<<sk.q<<std::endl;
+    sk_f<<sk.dP<<std::endl;
+    sk_f<<sk.dQ<<std::endl;
+    sk_f<<sk.qInv<<std::endl;
+    sk_f<<sk.version<<std::endl;
     std::cout<<"Writing to sk file done. "<<sk_file_name<<std::endl;
 }
 
-void encrypt_cmd(const std::string &stuff, std::string output = "", bool is_stuff_path=false, bool is_output_path=false, const std::string &pk_file_name="pk.txt", bool base64=true)
+// Calls f(std::type_identity<T>()) with the backend for keys with a modulus of n_bits bits: the
+// FixedInt of the sizes in common use, whose exponentiation has the limb count built in, for
+// the moduli it takes (see fixed_int_limbs_of), IntegerType for all others.
+template<typename F>
+void with_key_backend(size_t n_bits, F f)
+{
+#ifdef __SIZEOF_INT128__
+    size_t k = (n_bits + 63) / 64;
+    auto takes = [k](size_t bits) { return k == fixed_int_limbs_of(bits) || k == fixed_int_limbs_of(bits) + 1; };
+    if (takes(1024)) return f(std::type_identity<FixedInt<1024>>());
+    if (takes(2048)) return f(std::type_identity<FixedInt<2048>>());
+    if (takes(3072)) return f(std::type_identity<FixedInt<3072>>());
+    if (takes(4096)) return f(std::type_identity<FixedInt<4096>>());
+#endif
+    f(std::type_identity<IntegerType>());
+}
+
+// pool for the fragment work, none when only one thread is wanted
+std::unique_ptr<ThreadPool> make_thread_pool(int thread_num)
+{
+    if (thread_num <= 0) thread_num = std::max(1u, std::thread::hardware_concurrency());
+    if (thread_num == 1) return nullptr;
+    return std::make_unique<ThreadPool>(thread_num);
+}
+
+void encrypt_cmd(const std::string &stuff, std::string output = "", bool is_stuff_path=false, bool is_output_path=false, const std::string &pk_file_name="pk.txt", bool base64=true, int thread_num=0)
 {
     if (output.empty() && is_output_path) output = stuff + ".e";
 
     std::cout<<"Reading pk file..."<<std::endl;
-    std::ifstream in(pk_file_name);
-    if (!in) {
-        std::cout<<"Read pk file failed, "<<pk_file_name<<std::endl;
-        return;
+    PublicKey<IntegerType> pk;
+    if (is_key_file(pk_file_name)) {
+        if (!load_key_file(pk_file_name, pk)) {
+            std::cout<<"Read pk file failed, "<<pk_file_name<<std::endl;
+            return;
+        }
+    } else {
+        std::ifstream in(pk_file_name);
+        if (!in) {
+            std::cout<<"Read pk file failed, "<<pk_file_name<<std::endl;
+            return;
+        }
+        in>>pk.e;
+        in>>pk.n;
+        in>>pk.fragment_size;
+        in>>pk.encrypt_fragment_size;
+        in>>pk.encrypt_byte_val;
+        // older pk files have no version
+        if (!(in>>pk.version)) pk.version = KEY_VERSION_DECIMAL;
+        in.close();
     }
-    PublicKey<Integer<>> pk;
-    in>>pk.e;
-    in>>pk.n;
-    in>>pk.fragment_size;
-    in>>pk.encrypt_fragment_size;
-    in>>pk.encrypt_byte_val;
-    in.close();
 
     std::cout<<"> pk:"<<std::endl;
     std::cout<<"> e: "<<pk.e<<std::endl;
@@ -57,62 +123,83 @@ void encrypt_cmd(const std::string &stuff, std::string output = "", bool is_stuf
     std::cout<<"> fragment_size: "<<pk.fragment_size<<std::endl;
     std::cout<<"> encrypt_fragment_size: "<<pk.encrypt_fragment_size<<std::endl;
     std::cout<<"> encrypt_byte_val: "<<pk.encrypt_byte_val<<std::endl;
+    std::cout<<"> version: "<<pk.version<<std::endl;
     std::cout<<std::endl;
 
     std::cout<<"Reading stuff: "<<stuff<<std::endl;
-    std::vector<uint8_t> M;
+    std::ifstream f;
+    std::istringstream stuff_in;
+    uint64_t length = stuff.size();
     if (is_stuff_path)
     {
-        std::ifstream f(stuff, std::ios::in | std::ios::binary);
-        char c;
-        while (f.get(c)) M.push_back(c);
-        f.close();
-    } else {
-        M = string_to_bytes(stuff);
-    }
+        f.open(stuff, std::ios::in | std::ios::binary);
+        if (!f) {
+            std::cout<<"Can\'t open stuff file."<<std::endl;
+            return;
+        }
+        // pipes can't seek, their length is found at the end
+        std::streamoff end = f.seekg(0, std::ios::end) ? std::streamoff(f.tellg()) : -1;
+        f.clear();
+        if (end < 0 || !f.seekg(0)) {
+            f.clear();
+            length = CIPHER_LENGTH_UNKNOWN;
+        } else length = uint64_t(end);
+    } else stuff_in.str(stuff);
+    std::istream &src = is_stuff_path ? static_cast<std::istream&>(f) : stuff_in;
 
-    auto C = encrypt(M, pk);
-    std::cout<<"Encryption done!"<<std::endl;
-
-    if (base64) {
-        auto C_base64 = bytes_to_base64(C);
-        if (is_output_path)
-        {
-            std::ofstream out(output);
-            if (!out) {
-                std::cout<<"Can\'t open output file."<<std::endl;
-                return;
-            }
-            out << C_base64;
-            out.close();
-        } else std::cout<<C_base64<<std::endl;
-    } else {
-        if (is_output_path)
-        {
-            std::ofstream out(output, std::ios::out | std::ios::binary);
-            for (auto &c:C) out.put(c);
-            out.close();
-        } else std::cout<<bytes_to_base64(C)<<std::endl;
+    std::ofstream out;
+    if (is_output_path)
+    {
+        out.open(output, std::ios::out | std::ios::binary);
+        if (!out) {
+            std::cout<<"Can\'t open output file."<<std::endl;
+            return;
+        }
     }
+
+    // the console always gets base64
+    auto pool = make_thread_pool(thread_num);
+    bool ok = false;
+    with_key_backend(pk.n.bit_length(), [&](auto backend) {
+        PublicKey<typename decltype(backend)::type> key;
+        if (!key_cast(pk, key)) {
+            std::cout<<"[ERROR] The pk doesn't fit the backend of its size."<<std::endl;
+            return;
+        }
+        ok = encrypt_stream(src, length, is_output_path ? static_cast<std::ostream&>(out) : std::cout, key, pool.get(), base64 || !is_output_path);
+    });
+    if (!is_output_path) std::cout<<std::endl;
+    if (ok) std::cout<<"Encryption done!"<<std::endl;
 }
 
-void decrypt_cmd(const std::string &stuff, std::string output = "", bool is_stuff_path=false, bool is_output_path=false, const std::string &sk_file_name="sk.txt", bool base64=true)
+void decrypt_cmd(const std::string &stuff, std::string output = "", bool is_stuff_path=false, bool is_output_path=false, const std::string &sk_file_name="sk.txt", bool base64=true, int thread_num=0)
 {
     if (output.empty() && is_output_path) output = stuff + ".d";
 
     std::cout<<"Reading sk file..."<<std::endl;
-    std::ifstream in(sk_file_name);
-    if (!in) {
-        std::cout<<"Read sk file failed, "<<sk_file_name<<std::endl;
-        return;
+    SecreteKey<IntegerType> sk;
+    if (is_key_file(sk_file_name)) {
+        if (!load_key_file(sk_file_name, sk)) {
+            std::cout<<"Read sk file failed, "<<sk_file_name<<std::endl;
+            return;
+        }
+    } else {
+        std::ifstream in(sk_file_name);
+        if (!in) {
+            std::cout<<"Read sk file failed, "<<sk_file_name<<std::endl;
+            return;
+        }
+        in>>sk.d;
+        in>>sk.n;
+        in>>sk.fragment_size;
+        in>>sk.encrypt_fragment_size;
+        in>>sk.encrypt_byte_val;
+        // CRT components are optional, older sk files end here
+        if (!(in>>sk.p>>sk.q>>sk.dP>>sk.dQ>>sk.qInv)) {
+            sk.p = sk.q = sk.dP = sk.dQ = sk.qInv = IntegerType(0);
+        } else if (!(in>>sk.version)) sk.version = KEY_VERSION_DECIMAL;
+        in.close();
     }
-    SecreteKey<Integer<>> sk;
-    in>>sk.d;
-    in>>sk.n;
-    in>>sk.fragment_size;
-    in>>sk.encrypt_fragment_size;
-    in>>sk.encrypt_byte_val;
-    in.close();
 
     std::cout<<"> sk:"<<std::endl;
     std::cout<<"> d: "<<sk.d<<std::endl;
@@ -120,35 +207,51 @@ void decrypt_cmd(const std::string &stuff, std::string output = "", bool is_stuf
     std::cout<<"> fragment_size: "<<sk.fragment_size<<std::endl;
     std::cout<<"> encrypt_fragment_size: "<<sk.encrypt_fragment_size<<std::endl;
     std::cout<<"> encrypt_byte_val: "<<sk.encrypt_byte_val<<std::endl;
+    std::cout<<"> version: "<<sk.version<<std::endl;
+    if (sk.has_crt()) {
+        std::cout<<"> p: "<<sk.p<<std::endl;
+        std::cout<<"> q: "<<sk.q<<std::endl;
+        std::cout<<"> dP: "<<sk.dP<<std::endl;
+        std::cout<<"> dQ: "<<sk.dQ<<std::endl;
+        std::cout<<"> qInv: "<<sk.qInv<<std::endl;
+    } else std::cout<<"> no CRT components, using d directly"<<std::endl;
     std::cout<<std::endl;
 
     std::cout<<"Reading stuff: "<<stuff<<std::endl;
-    std::vector<uint8_t> C;
+    std::ifstream f;
+    std::istringstream stuff_in;
     if (is_stuff_path)
     {
-        std::ifstream f(stuff, std::ios::in | std::ios::binary);
-        char c;
-        while (f.get(c)) C.push_back(c);
-        f.close();
-
-        if (base64) C = base64_to_bytes(bytes_to_string(C));
-    } else {
-        if (base64)
-            C = base64_to_bytes(stuff);
-        else
-            C = string_to_bytes(stuff);
-    }
-
-    auto M = decrypt(C, sk);
-    std::cout<<"Decryption done!"<<std::endl;
-
+        f.open(stuff, std::ios::in | std::ios::binary);
+        if (!f) {
+            std::cout<<"Can\'t open stuff file."<<std::endl;
+            return;
+        }
+    } else stuff_in.str(stuff);
+    std::istream &src = is_stuff_path ? static_cast<std::istream&>(f) : stuff_in;
 
+    std::ofstream out;
     if (is_output_path)
     {
-        std::ofstream out(output, std::ios::out | std::ios::binary);
-        for (auto &c:M) out.put(c);
-        out.close();
-    } else std::cout<<bytes_to_string(M)<<std::endl;
+        out.open(output, std::ios::out | std::ios::binary);
+        if (!out) {
+            std::cout<<"Can\'t open output file."<<std::endl;
+            return;
+        }
+    }
+
+    auto pool = make_thread_pool(thread_num);
+    bool ok = false;
+    with_key_backend(sk.n.bit_length(), [&](auto backend) {
+        SecreteKey<typename decltype(backend)::type> key;
+        if (!key_cast(sk, key)) {
+            std::cout<<"[ERROR] The sk doesn't fit the backend of its size."<<std::endl;
+            return;
+        }
+        ok = decrypt_stream(src, is_output_path ? static_cast<std::ostream&>(out) : std::cout, key, pool.get(), base64);
+    });
+    if (!is_output_path) std::cout<<std::endl;
+    if (ok) std::cout<<"Decryption done!"<<std::endl;
 }
 
 void print_help()
@@ -160,9 +263,11 @@ void print_help()
 |                                                           |
 |===========================================================|
 command:
-g [size=512] [public key file path=pk.txt] [secrete key file path=sk.txt] - Generate RSA key pairs
-e <stuff that need to be encrypted> <output> [is_stuff_path=false] [is_output_path=false] [public key file path=pk.txt] [base64=true] - Encrypt file using public key
-d <stuff that need to be decrypted> <output> [is_stuff_path=false] [is_output_path=false] [secrete key file path=sk.txt] [base64=true] - Decrypt file using secrete key
+g [size=512] [public key file path=pk.txt] [secrete key file path=sk.txt] [threads=0] [binary=false] [bpsw=false] - Generate RSA key pairs, threads=0 uses all hardware threads,
+    binary key files carry precomputed constants and load without parsing, e and d tell both formats apart by themselves,
+    bpsw tests primes with Baillie-PSW instead of Miller-Rabin rounds picked by size
+e <stuff that need to be encrypted> <output> [is_stuff_path=false] [is_output_path=false] [public key file path=pk.txt] [base64=true] [threads=0] - Encrypt file using public key
+d <stuff that need to be decrypted> <output> [is_stuff_path=false] [is_output_path=false] [secrete key file path=sk.txt] [base64=true] [threads=0] - Decrypt file using secrete key
 )"<<std::endl;
 }
 
@@ -198,13 +303,17 @@ int main(int argv, char** _args) {
         print_help();
     } else if (args[0] == "g")
     {
-        if (args.size() >= 4) generate_key_pair(to_<int>(args[1]), args[2], args[3]);
+        if (args.size() >= 7) generate_key_pair(to_<int>(args[1]), args[2], args[3], to_<int>(args[4]), to_<bool>(args[5]), to_<bool>(args[6]));
+        else if (args.size() >= 6) generate_key_pair(to_<int>(args[1]), args[2], args[3], to_<int>(args[4]), to_<bool>(args[5]));
+        else if (args.size() >= 5) generate_key_pair(to_<int>(args[1]), args[2], args[3], to_<int>(args[4]));
+        else if (args.size() >= 4) generate_key_pair(to_<int>(args[1]), args[2], args[3]);
         else if (args.size() >= 3) generate_key_pair(to_<int>(args[1]), args[2]);
         else if (args.size() >= 2) generate_key_pair(to_<int>(args[1]));
         else generate_key_pair();
     } else if (args[0] == "e")
     {
-        if (args.size() >= 7) encrypt_cmd(args[1], args[2], to_<bool>(args[3]), to_<bool>(args[4]), args[5], to_<bool>(args[6]));
+        if (args.size() >= 8) encrypt_cmd(args[1], args[2], to_<bool>(args[3]), to_<bool>(args[4]), args[5], to_<bool>(args[6]), to_<int>(args[7]));
+        else if (args.size() >= 7) encrypt_cmd(args[1], args[2], to_<bool>(args[3]), to_<bool>(args[4]), args[5], to_<bool>(args[6]));
         else if (args.size() >= 6) encrypt_cmd(args[1], args[2], to_<bool>(args[3]), to_<bool>(args[4]), args[5]);
         else if (args.size() >= 5) encrypt_cmd(args[1], args[2], to_<bool>(args[3]), to_<bool>(args[4]));
         else if (args.size() >= 4) encrypt_cmd(args[1], args[2], to_<bool>(args[3]));
@@ -216,7 +325,8 @@ int main(int argv, char** _args) {
         }
     } else if (args[0] == "d")
     {
-        if (args.size() >= 7) decrypt_cmd(args[1], args[2], to_<bool>(args[3]), to_<bool>(args[4]), args[5], to_<bool>(args[6]));
+        if (args.size() >= 8) decrypt_cmd(args[1], args[2], to_<bool>(args[3]), to_<bool>(args[4]), args[5], to_<bool>(args[6]), to_<int>(args[7]));
+        else if (args.size() >= 7) decrypt_cmd(args[1], args[2], to_<bool>(args[3]), to_<bool>(args[4]), args[5], to_<bool>(args[6]));
         else if (args.size() >= 6) decrypt_cmd(args[1], args[2], to_<bool>(args[3]), to_<bool>(args[4]), args[5]);
         else if (args.size() >= 5) decrypt_cmd(args[1], args[2], to_<bool>(args[3]), to_<bool>(args[4]));
         else if (args.size() >= 4) decrypt_cmd(args[1], args[2], to_<bool>(args[3]));